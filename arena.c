@@ -0,0 +1,150 @@
+#include "arena.h"
+
+#include <gmp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*--------------------------------------------------------------------*/
+// ARENAS
+
+#define ARENA_ALIGN 16
+
+void arena_init (arena* a) {
+    a->chunks = NULL;
+    a->allocations = 0;
+    a->chunk_count = 0;
+}
+
+// Chunks are allocated lazily, so an arena that is never used costs nothing
+void* arena_alloc (arena* a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+
+    arena_chunk* chunk = a->chunks;
+    if (chunk == NULL || chunk->used + size > chunk->size) {
+        size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        chunk = malloc(sizeof(arena_chunk) + ARENA_ALIGN + chunk_size);
+        chunk->size = chunk_size;
+        chunk->used = 0;
+
+        // An oversized chunk goes behind the head, so the head's free space
+        // stays available to later small allocations
+        if (a->chunks != NULL && chunk_size > ARENA_CHUNK_SIZE) {
+            chunk->next = a->chunks->next;
+            a->chunks->next = chunk;
+        } else {
+            chunk->next = a->chunks;
+            a->chunks = chunk;
+        }
+        a->chunk_count++;
+    }
+
+    uintptr_t base = ((uintptr_t) (chunk + 1) + ARENA_ALIGN - 1) & ~(uintptr_t) (ARENA_ALIGN - 1);
+    void* p = (char*) base + chunk->used;
+    chunk->used += size;
+    a->allocations++;
+    return p;
+}
+
+char* arena_strdup (arena* a, const char* s) {
+    size_t length = strlen(s) + 1;
+    char* copy = arena_alloc(a, length);
+    memcpy(copy, s, length);
+    return copy;
+}
+
+// Moves every chunk of from into into, leaving from empty; the caller
+// serializes access to into
+void arena_adopt (arena* into, arena* from) {
+    if (from->chunks == NULL) return;
+
+    arena_chunk* last = from->chunks;
+    while (last->next != NULL) last = last->next;
+
+    // Keep into's head chunk first, since it is the one being allocated from
+    if (into->chunks == NULL) {
+        into->chunks = from->chunks;
+    } else {
+        last->next = into->chunks->next;
+        into->chunks->next = from->chunks;
+    }
+    into->allocations += from->allocations;
+    into->chunk_count += from->chunk_count;
+    arena_init(from);
+}
+
+// Releases everything allocated from the arena at once
+void arena_free (arena* a) {
+    arena_chunk* chunk = a->chunks;
+    while (chunk != NULL) {
+        arena_chunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena_init(a);
+}
+
+/*--------------------------------------------------------------------*/
+// GMP ALLOCATOR
+
+// Every block handed to GMP is preceded by a header saying where it came
+// from, so blocks can be reallocated or freed long after the arena that
+// was current when they were allocated
+#define GMP_BLOCK_HEAP 0x68656170UL
+#define GMP_BLOCK_ARENA 0x6172656eUL
+
+typedef struct gmp_block {
+    unsigned long tag;
+    unsigned long pad;
+} gmp_block;
+
+__thread arena* current_arena = NULL;
+pthread_once_t gmp_installed = PTHREAD_ONCE_INIT;
+
+void* gmp_alloc (size_t size) {
+    gmp_block* block;
+    if (current_arena != NULL) {
+        block = arena_alloc(current_arena, sizeof(gmp_block) + size);
+        block->tag = GMP_BLOCK_ARENA;
+    } else {
+        block = malloc(sizeof(gmp_block) + size);
+        block->tag = GMP_BLOCK_HEAP;
+    }
+    return block + 1;
+}
+
+void* gmp_realloc (void* p, size_t old_size, size_t new_size) {
+    gmp_block* block = (gmp_block*) p - 1;
+    if (block->tag == GMP_BLOCK_HEAP && current_arena == NULL) {
+        block = realloc(block, sizeof(gmp_block) + new_size);
+        return block + 1;
+    }
+
+    // Arena blocks cannot grow in place; the old copy goes with its arena
+    void* moved = gmp_alloc(new_size);
+    memcpy(moved, p, old_size < new_size ? old_size : new_size);
+    if (block->tag == GMP_BLOCK_HEAP) free(block);
+    return moved;
+}
+
+void gmp_free (void* p, size_t size) {
+    gmp_block* block = (gmp_block*) p - 1;
+    if (block->tag == GMP_BLOCK_HEAP) free(block);
+}
+
+void install_gmp_allocator () {
+    mp_set_memory_functions(gmp_alloc, gmp_realloc, gmp_free);
+}
+
+void arena_install_gmp () {
+    pthread_once(&gmp_installed, install_gmp_allocator);
+}
+
+// Makes a the calling thread's current arena (NULL for the heap), returning
+// the previous one so that it can be restored
+arena* arena_use (arena* a) {
+    arena* previous = current_arena;
+    current_arena = a;
+    return previous;
+}
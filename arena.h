@@ -0,0 +1,39 @@
+#ifndef SOLSYS_ARENA_H
+#define SOLSYS_ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator for nodes that are all released together. Chunks are only
+// malloc'd when the current one is full, and nothing is freed piecemeal.
+
+// Default chunk size; larger requests get a chunk of their own
+#define ARENA_CHUNK_SIZE (1 << 16)
+
+typedef struct arena_chunk {
+    struct arena_chunk* next;
+    size_t size;
+    size_t used;
+    // followed by size bytes of storage
+} arena_chunk;
+
+typedef struct arena {
+    arena_chunk* chunks; // most recent first; allocation only uses the head
+
+    // Allocations served, and how many chunk mallocs they cost
+    unsigned long allocations;
+    unsigned long chunk_count;
+} arena;
+
+void arena_init(arena*);
+void* arena_alloc(arena*, size_t size);
+char* arena_strdup(arena*, const char* s);
+void arena_adopt(arena* into, arena* from);
+void arena_free(arena*);
+
+// GMP allocations are carved from the calling thread's current arena while it
+// has one, and come from the heap otherwise. The allocator must be installed
+// before GMP is first used, since it cannot free blocks it did not hand out.
+void arena_install_gmp();
+arena* arena_use(arena*);
+
+#endif
@@ -0,0 +1,58 @@
+//go:build !pool
+
+package main
+
+/*
+#cgo CFLAGS: -I${SRCDIR}/.. -I${SRCDIR}/../msieve-1.53/include -I${SRCDIR}/../primecount/include -I${SRCDIR}/../logint
+#cgo LDFLAGS: -Wl,--wrap=mpz_aprcl ${SRCDIR}/../libsolsys.a ${SRCDIR}/../msieve-1.53/libmsieve.a ${SRCDIR}/../primecount/libprimecount.a ${SRCDIR}/../primecount/lib/primesieve/libprimesieve.a -ldl -lz -lm -lgomp -lpthread -lstdc++ -lmpfr -lgmp
+#include <stdlib.h>
+#include "solsys.h"
+*/
+import "C"
+
+import (
+    "errors"
+    "unsafe"
+)
+
+// One context lives for the whole process, so the factor cache, pi table and
+// logint state stay warm across invocations instead of dying with a child
+var ctx *C.solsys_ctx
+
+func initBackend() {
+    var options C.solsys_options
+    C.solsys_default_options(&options)
+
+    // Strings are only read during solsys_create, so they can be freed after
+    cache := C.CString(cacheFile)
+    defer C.free(unsafe.Pointer(cache))
+    piTable := C.CString(piTableFile)
+    defer C.free(unsafe.Pointer(piTable))
+
+    // Compact JSON keeps the response payload small
+    options.compact = 1
+    options.cache_file = cache
+    options.pi_table_enabled = 1
+    options.pi_table_path = piTable
+    options.deadline_ms = C.long(deadlineMs())
+    ctx = C.solsys_create(&options)
+}
+
+func factorize(x string) (string, error) {
+    number := C.CString(x)
+    defer C.free(unsafe.Pointer(number))
+
+    tree := C.solsys_factor_tree(ctx, number)
+    if tree == nil {
+        return "", errors.New("factorization failed")
+    }
+
+    var length C.size_t
+    buf := C.solsys_to_buffer(ctx, tree, &length)
+    if buf == nil {
+        return "", errors.New("could not render factor tree")
+    }
+    defer C.free(unsafe.Pointer(buf))
+
+    return C.GoStringN(buf, C.int(length)), nil
+}
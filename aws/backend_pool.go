@@ -0,0 +1,101 @@
+//go:build pool
+
+package main
+
+import (
+    "bufio"
+    "errors"
+    "io"
+    "os"
+    "os/exec"
+    "runtime"
+    "strconv"
+    "strings"
+)
+
+// A long-lived `solsys --serve` process. Requests and replies are single
+// lines, so one request is in flight per worker at a time.
+type serveWorker struct {
+    cmd    *exec.Cmd
+    stdin  io.WriteCloser
+    stdout *bufio.Reader
+}
+
+// Idle workers; a request takes one out and puts it back when answered
+var pool chan *serveWorker
+
+func initBackend() {
+    size := runtime.NumCPU()
+    if n, err := strconv.Atoi(os.Getenv("SOLSYS_WORKERS")); err == nil && n > 0 {
+        size = n
+    }
+
+    pool = make(chan *serveWorker, size)
+    for ii := 0; ii < size; ii++ {
+        w, err := startWorker()
+        if err != nil {
+            panic(err)
+        }
+        pool <- w
+    }
+}
+
+func startWorker() (*serveWorker, error) {
+    args := []string{"--serve", "--cache-file", cacheFile, "--pi-table", piTableFile}
+    if ms := deadlineMs(); ms > 0 {
+        args = append(args, "--deadline-ms", strconv.Itoa(ms))
+    }
+    cmd := exec.Command("./solsys", args...)
+    cmd.Stderr = os.Stderr
+    stdin, err := cmd.StdinPipe()
+    if err != nil {
+        return nil, err
+    }
+    stdout, err := cmd.StdoutPipe()
+    if err != nil {
+        return nil, err
+    }
+    if err := cmd.Start(); err != nil {
+        return nil, err
+    }
+    return &serveWorker{cmd, stdin, bufio.NewReader(stdout)}, nil
+}
+
+func (w *serveWorker) stop() {
+    w.stdin.Close()
+    w.cmd.Wait()
+}
+
+func factorize(x string) (string, error) {
+    w := <-pool
+    if w == nil {
+        // An earlier restart failed; try again now rather than lose the slot
+        var err error
+        if w, err = startWorker(); err != nil {
+            pool <- nil
+            return "", err
+        }
+    }
+
+    reply, err := w.request(x)
+    if err != nil {
+        // The worker died mid-request, so replace it rather than reuse it
+        w.stop()
+        w, _ = startWorker()
+        pool <- w
+        return "", errors.New("solsys worker failed")
+    }
+    pool <- w
+
+    if strings.HasPrefix(reply, "{\"error\"") {
+        return "", errors.New(reply)
+    }
+    return reply, nil
+}
+
+func (w *serveWorker) request(x string) (string, error) {
+    if _, err := io.WriteString(w.stdin, x+"\n"); err != nil {
+        return "", err
+    }
+    return w.stdout.ReadString('\n')
+}
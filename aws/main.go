@@ -1,31 +1,54 @@
 package main
 
 import (
+    "errors"
+    "os"
+    "strconv"
+
 	"github.com/aws/aws-lambda-go/lambda"
-    "os/exec"
 )
 type BasicRequest struct {
     X string `json:"x"`
 }
 
+// /tmp survives between warm invocations, so results cached there are reused
+const cacheFile = "/tmp/solsys.cache"
+const piTableFile = "/tmp/solsys.pitable"
+
+// factorize and initBackend come from backend_cgo.go, which links libsolsys
+// into this process, or from backend_pool.go (built with -tags pool), which
+// keeps a pool of `solsys --serve` processes instead
 func lambda_factorize(event BasicRequest) (string, error) {
-    return exec_factorize(event.X, []string{})
+    if !isDecimal(event.X) {
+        return "", errors.New("x must be a non-negative decimal integer")
+    }
+    return factorize(event.X)
 }
 
-func exec_factorize(x string, flags []string) (string, error) {
-    var args []string
-    args = append(args, x)
-    args = append(args, flags...)
+// SOLSYS_DEADLINE_MS bounds each request below the Lambda timeout, so a slow
+// tree comes back partial, with pending composites, instead of not at all
+func deadlineMs() int {
+    if n, err := strconv.Atoi(os.Getenv("SOLSYS_DEADLINE_MS")); err == nil && n > 0 {
+        return n
+    }
+    return 0
+}
 
-    cmd := exec.Command("./solsys", args...)
-    stdout, err := cmd.Output()
-    if err != nil {
-        return "", err;
+func isDecimal(x string) bool {
+    if len(x) == 0 {
+        return false
+    }
+    for _, c := range x {
+        if c < '0' || c > '9' {
+            return false
+        }
     }
-    return string(stdout), nil;
+    return true
 }
 
 func main() {
+    initBackend()
+
 	// Make the handler available for Remote Procedure Call by AWS Lambda
 	lambda.Start(lambda_factorize)
 }
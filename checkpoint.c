@@ -0,0 +1,364 @@
+#include "checkpoint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*--------------------------------------------------------------------*/
+// CREATING AND FREEING
+
+checkpoint* checkpoint_create (const char* path) {
+    checkpoint* c = malloc(sizeof(checkpoint));
+    c->path = path != NULL ? strdup(path) : NULL;
+    c->bucket_count = 256;
+    c->buckets = calloc(c->bucket_count, sizeof(checkpoint_entry*));
+    c->size = 0;
+    c->generation = 0;
+    pthread_mutex_init(&c->lock, NULL);
+    return c;
+}
+
+void checkpoint_free (checkpoint* c) {
+    if (c == NULL) return;
+    for (unsigned long ii = 0; ii < c->bucket_count; ii++) {
+        checkpoint_entry* entry = c->buckets[ii];
+        while (entry != NULL) {
+            checkpoint_entry* next = entry->next;
+            free(entry->key);
+            free(entry->value);
+            free(entry);
+            entry = next;
+        }
+    }
+    free(c->buckets);
+    free(c->path);
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+}
+
+/*--------------------------------------------------------------------*/
+// INDEX
+
+unsigned long checkpoint_hash (enum checkpoint_kind kind, const char* key) {
+    unsigned long hash = 14695981039346656037UL ^ kind;
+    for (const char* c = key; *c != '\0'; c++) {
+        hash ^= (unsigned char) *c;
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+void checkpoint_grow (checkpoint* c) {
+    unsigned long bucket_count = c->bucket_count * 2;
+    checkpoint_entry** buckets = calloc(bucket_count, sizeof(checkpoint_entry*));
+
+    for (unsigned long ii = 0; ii < c->bucket_count; ii++) {
+        checkpoint_entry* entry = c->buckets[ii];
+        while (entry != NULL) {
+            checkpoint_entry* next = entry->next;
+            entry->next = buckets[entry->hash % bucket_count];
+            buckets[entry->hash % bucket_count] = entry;
+            entry = next;
+        }
+    }
+
+    free(c->buckets);
+    c->buckets = buckets;
+    c->bucket_count = bucket_count;
+}
+
+// Must hold c->lock
+checkpoint_entry** checkpoint_find (checkpoint* c, enum checkpoint_kind kind, const char* key) {
+    unsigned long hash = checkpoint_hash(kind, key);
+    checkpoint_entry** link = &c->buckets[hash % c->bucket_count];
+    while (*link != NULL) {
+        checkpoint_entry* entry = *link;
+        if (entry->hash == hash && entry->kind == kind && strcmp(entry->key, key) == 0) return link;
+        link = &entry->next;
+    }
+    return link;
+}
+
+/*--------------------------------------------------------------------*/
+// LOOKUP AND UPDATE
+
+// Returns a malloc'd, NUL terminated copy of the value for key, or NULL
+char* checkpoint_get (checkpoint* c, enum checkpoint_kind kind, const char* key, size_t* length) {
+    if (c == NULL) return NULL;
+
+    pthread_mutex_lock(&c->lock);
+    checkpoint_entry* entry = *checkpoint_find(c, kind, key);
+    char* value = NULL;
+    if (entry != NULL) {
+        value = malloc(entry->value_length + 1);
+        memcpy(value, entry->value, entry->value_length + 1);
+        if (length != NULL) *length = entry->value_length;
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    return value;
+}
+
+// Sets the value for key, replacing any earlier one. A replaced entry keeps
+// its generation, so an earlier unfinished request still keeps it.
+void checkpoint_put (checkpoint* c, enum checkpoint_kind kind, const char* key, const char* value, size_t length) {
+    if (c == NULL) return;
+
+    char* copy = malloc(length + 1);
+    memcpy(copy, value, length);
+    copy[length] = '\0';
+
+    pthread_mutex_lock(&c->lock);
+    checkpoint_entry** link = checkpoint_find(c, kind, key);
+    if (*link != NULL) {
+        free((*link)->value);
+        (*link)->value = copy;
+        (*link)->value_length = length;
+    } else {
+        checkpoint_entry* entry = malloc(sizeof(checkpoint_entry));
+        entry->hash = checkpoint_hash(kind, key);
+        entry->kind = kind;
+        entry->key = strdup(key);
+        entry->value = copy;
+        entry->value_length = length;
+        entry->generation = c->generation;
+        entry->next = NULL;
+        *link = entry;
+        c->size++;
+        if (c->size > c->bucket_count) checkpoint_grow(c);
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+void checkpoint_remove (checkpoint* c, enum checkpoint_kind kind, const char* key) {
+    if (c == NULL) return;
+
+    pthread_mutex_lock(&c->lock);
+    checkpoint_entry** link = checkpoint_find(c, kind, key);
+    checkpoint_entry* entry = *link;
+    if (entry != NULL) {
+        *link = entry->next;
+        free(entry->key);
+        free(entry->value);
+        free(entry);
+        c->size--;
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+// Returns a malloc'd array of malloc'd copies of every key of a kind
+char** checkpoint_keys (checkpoint* c, enum checkpoint_kind kind, int* count) {
+    *count = 0;
+    if (c == NULL) return NULL;
+
+    pthread_mutex_lock(&c->lock);
+    char** keys = malloc(sizeof(char*) * (c->size + 1));
+    for (unsigned long ii = 0; ii < c->bucket_count; ii++) {
+        for (checkpoint_entry* entry = c->buckets[ii]; entry != NULL; entry = entry->next) {
+            if (entry->kind == kind) keys[(*count)++] = strdup(entry->key);
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    return keys;
+}
+
+unsigned long checkpoint_count (checkpoint* c, enum checkpoint_kind kind) {
+    if (c == NULL) return 0;
+
+    unsigned long count = 0;
+    pthread_mutex_lock(&c->lock);
+    for (unsigned long ii = 0; ii < c->bucket_count; ii++) {
+        for (checkpoint_entry* entry = c->buckets[ii]; entry != NULL; entry = entry->next) {
+            count += entry->kind == kind;
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    return count;
+}
+
+/*--------------------------------------------------------------------*/
+// GENERATIONS
+
+// Starts a request, returning the generation its entries are put under
+unsigned long checkpoint_begin (checkpoint* c) {
+    if (c == NULL) return 0;
+    pthread_mutex_lock(&c->lock);
+    unsigned long generation = ++c->generation;
+    pthread_mutex_unlock(&c->lock);
+    return generation;
+}
+
+// Removes every entry of the given kinds, a mask of checkpoint_kind, or only
+// those of one generation
+void checkpoint_drop (checkpoint* c, int kinds, int any_generation, unsigned long generation) {
+    if (c == NULL) return;
+
+    pthread_mutex_lock(&c->lock);
+    for (unsigned long ii = 0; ii < c->bucket_count; ii++) {
+        checkpoint_entry** link = &c->buckets[ii];
+        while (*link != NULL) {
+            checkpoint_entry* entry = *link;
+            if ((entry->kind & kinds) && (any_generation || entry->generation == generation)) {
+                *link = entry->next;
+                free(entry->key);
+                free(entry->value);
+                free(entry);
+                c->size--;
+            } else {
+                link = &entry->next;
+            }
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+// Drops what a finished request put, which no unfinished tree needs
+void checkpoint_forget (checkpoint* c, int kinds, unsigned long generation) {
+    checkpoint_drop(c, kinds, 0, generation);
+}
+
+void checkpoint_clear (checkpoint* c, int kinds) {
+    checkpoint_drop(c, kinds, 1, 0);
+}
+
+/*--------------------------------------------------------------------*/
+// FILES
+
+// Adds every record of the checkpoint at path, returning 0 if it cannot be
+// read; records after a damaged one are dropped
+int checkpoint_load (checkpoint* c, const char* path) {
+    FILE* in = fopen(path, "rb");
+    if (in == NULL) return 0;
+
+    char magic[8];
+    uint64_t count;
+    struct stat st;
+    if (fread(magic, 8, 1, in) != 1 || memcmp(magic, CHECKPOINT_MAGIC, 8) != 0 || fread(&count, sizeof(count), 1, in) != 1
+        || fstat(fileno(in), &st) != 0) {
+        fprintf(stderr, "%s is not a solsys checkpoint\n", path);
+        fclose(in);
+        return 0;
+    }
+
+    // Every length is bounded by the bytes left in the file, so a damaged
+    // record is rejected rather than trusted with an allocation
+    uint64_t remaining = (uint64_t) st.st_size - 8 - sizeof(count);
+    int damaged = 0;
+    for (uint64_t ii = 0; ii < count && !damaged; ii++) {
+        checkpoint_record rec;
+        if (remaining < sizeof(rec) || fread(&rec, sizeof(rec), 1, in) != 1) {
+            damaged = 1;
+            break;
+        }
+        remaining -= sizeof(rec);
+        if (rec.key_length > remaining || rec.value_length > remaining - rec.key_length) {
+            damaged = 1;
+            break;
+        }
+        remaining -= rec.key_length + rec.value_length;
+
+        char* key = malloc(rec.key_length + 1);
+        char* value = malloc(rec.value_length + 1);
+        damaged = key == NULL || value == NULL
+            || fread(key, 1, rec.key_length, in) != rec.key_length
+            || fread(value, 1, rec.value_length, in) != rec.value_length;
+        if (!damaged) {
+            key[rec.key_length] = '\0';
+            checkpoint_put(c, rec.kind, key, value, rec.value_length);
+        }
+        free(key);
+        free(value);
+    }
+    fclose(in);
+
+    if (damaged) {
+        fprintf(stderr, "%s is damaged; ignoring it\n", path);
+        checkpoint_clear(c, CHECKPOINT_FACTORS | CHECKPOINT_PI | CHECKPOINT_LI | CHECKPOINT_ROOT | CHECKPOINT_SAVEFILE);
+        return 0;
+    }
+    return 1;
+}
+
+// Writes every record to the checkpoint's path through a temporary file, so
+// a crash mid-save leaves the previous checkpoint intact
+int checkpoint_save (checkpoint* c) {
+    if (c == NULL || c->path == NULL) return 0;
+
+    size_t length = strlen(c->path) + 5;
+    char* temporary = malloc(length);
+    snprintf(temporary, length, "%s.tmp", c->path);
+    FILE* out = fopen(temporary, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "could not write checkpoint %s\n", temporary);
+        free(temporary);
+        return 0;
+    }
+
+    pthread_mutex_lock(&c->lock);
+    uint64_t count = c->size;
+    int ok = fwrite(CHECKPOINT_MAGIC, 8, 1, out) == 1 && fwrite(&count, sizeof(count), 1, out) == 1;
+    for (unsigned long ii = 0; ii < c->bucket_count && ok; ii++) {
+        for (checkpoint_entry* entry = c->buckets[ii]; entry != NULL && ok; entry = entry->next) {
+            checkpoint_record rec = {0};
+            rec.kind = entry->kind;
+            rec.key_length = strlen(entry->key);
+            rec.value_length = entry->value_length;
+            ok = fwrite(&rec, sizeof(rec), 1, out) == 1
+                && fwrite(entry->key, 1, rec.key_length, out) == rec.key_length
+                && fwrite(entry->value, 1, rec.value_length, out) == rec.value_length;
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    ok = fclose(out) == 0 && ok;
+    if (ok) ok = rename(temporary, c->path) == 0;
+    if (!ok) {
+        fprintf(stderr, "could not write checkpoint %s\n", c->path);
+        unlink(temporary);
+    }
+    free(temporary);
+    return ok;
+}
+
+// Stores the file at path as the savefile for key. msieve appends gzip
+// members to it as it sieves; a member cut short by a snapshot only ends the
+// file early when msieve reads it back.
+int checkpoint_read_file (checkpoint* c, const char* key, const char* path) {
+    if (c == NULL) return 0;
+
+    FILE* in = fopen(path, "rb");
+    if (in == NULL) return 0;
+
+    size_t length = 0, capacity = 4096;
+    char* data = malloc(capacity);
+    size_t got;
+    while ((got = fread(data + length, 1, capacity - length, in)) > 0) {
+        length += got;
+        if (length == capacity) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+    }
+    fclose(in);
+
+    if (length > 0) checkpoint_put(c, CHECKPOINT_SAVEFILE, key, data, length);
+    free(data);
+    return length > 0;
+}
+
+// Restores the savefile for key to path, returning 0 if there is none
+int checkpoint_write_file (checkpoint* c, const char* key, const char* path) {
+    size_t length;
+    char* data = checkpoint_get(c, CHECKPOINT_SAVEFILE, key, &length);
+    if (data == NULL) return 0;
+
+    FILE* out = fopen(path, "wb");
+    int ok = out != NULL && fwrite(data, 1, length, out) == length;
+    if (out != NULL) ok = fclose(out) == 0 && ok;
+    free(data);
+    return ok;
+}
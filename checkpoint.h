@@ -0,0 +1,66 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// Snapshot of the requests a process is working on, so a tree cut short by a
+// deadline or a dying process can be finished by the next one. It holds the
+// roots still being built, every factorization and pi value found on the way
+// and the savefiles of interrupted msieve runs. The whole snapshot is
+// rewritten at each save, to a temporary file renamed over the last one, so
+// results are dropped as soon as no unfinished tree can need them.
+
+// Factorizations and pi values are numbered as in the store
+enum checkpoint_kind {
+    CHECKPOINT_FACTORS = 1,
+    CHECKPOINT_PI = 2,
+    CHECKPOINT_LI = 4,
+    CHECKPOINT_ROOT = 8,
+    CHECKPOINT_SAVEFILE = 16
+};
+
+#define CHECKPOINT_MAGIC "SOLSYSK1"
+
+// On disk: the magic, a uint64_t record count, then each record's header
+// followed by its key and value, unterminated
+typedef struct checkpoint_record {
+    uint8_t kind;
+    uint8_t pad[3];
+    uint32_t key_length;
+    uint64_t value_length;
+} checkpoint_record;
+
+typedef struct checkpoint_entry {
+    unsigned long hash;
+    enum checkpoint_kind kind;
+    char* key;
+    char* value;
+    size_t value_length;
+    unsigned long generation; // of the request that put it, 0 if loaded
+    struct checkpoint_entry* next;
+} checkpoint_entry;
+
+typedef struct checkpoint {
+    char* path; // NULL when resumed without saving again
+    checkpoint_entry** buckets;
+    unsigned long bucket_count;
+    unsigned long size;
+    unsigned long generation;
+    pthread_mutex_t lock;
+} checkpoint;
+
+checkpoint* checkpoint_create(const char* path);
+void checkpoint_free(checkpoint*);
+int checkpoint_load(checkpoint*, const char* path);
+int checkpoint_save(checkpoint*);
+
+char* checkpoint_get(checkpoint*, enum checkpoint_kind, const char* key, size_t* length);
+void checkpoint_put(checkpoint*, enum checkpoint_kind, const char* key, const char* value, size_t length);
+void checkpoint_remove(checkpoint*, enum checkpoint_kind, const char* key);
+char** checkpoint_keys(checkpoint*, enum checkpoint_kind, int* count);
+unsigned long checkpoint_count(checkpoint*, enum checkpoint_kind);
+unsigned long checkpoint_begin(checkpoint*);
+void checkpoint_forget(checkpoint*, int kinds, unsigned long generation);
+void checkpoint_clear(checkpoint*, int kinds);
+
+int checkpoint_read_file(checkpoint*, const char* key, const char* path);
+int checkpoint_write_file(checkpoint*, const char* key, const char* path);
@@ -0,0 +1,215 @@
+#include "factor64.h"
+
+#include <stdlib.h>
+
+/*--------------------------------------------------------------------*/
+// MONTGOMERY ARITHMETIC MODULO AN ODD n
+
+typedef unsigned __int128 u128;
+
+typedef struct montgomery {
+    uint64_t n;
+    uint64_t inv;  // n^-1 mod 2^64
+    uint64_t one;  // 2^64 mod n
+    uint64_t r2;   // 2^128 mod n
+} montgomery;
+
+void montgomery_init (montgomery* m, uint64_t n) {
+    // Newton iteration doubles the correct low bits of the inverse each step
+    uint64_t inv = n;
+    for (int ii = 0; ii < 5; ii++) inv *= 2 - n * inv;
+
+    m->n = n;
+    m->inv = inv;
+    m->one = (uint64_t) (-n) % n;
+    m->r2 = (uint64_t) ((u128) m->one * m->one % n);
+}
+
+// t * 2^-64 mod n, for t < n * 2^64
+static inline uint64_t montgomery_reduce (const montgomery* m, u128 t) {
+    uint64_t q = (uint64_t) t * m->inv;
+    uint64_t h = (uint64_t) (((u128) q * m->n) >> 64);
+    uint64_t hi = (uint64_t) (t >> 64);
+    return hi >= h ? hi - h : hi - h + m->n;
+}
+
+static inline uint64_t montgomery_mul (const montgomery* m, uint64_t a, uint64_t b) {
+    return montgomery_reduce(m, (u128) a * b);
+}
+
+static inline uint64_t montgomery_to (const montgomery* m, uint64_t a) {
+    return montgomery_mul(m, a % m->n, m->r2);
+}
+
+static inline uint64_t montgomery_add (const montgomery* m, uint64_t a, uint64_t b) {
+    uint64_t s = a + b;
+    return (s < a || s >= m->n) ? s - m->n : s;
+}
+
+uint64_t montgomery_pow (const montgomery* m, uint64_t base, uint64_t exp) {
+    uint64_t result = m->one;
+    while (exp > 0) {
+        if (exp & 1) result = montgomery_mul(m, result, base);
+        base = montgomery_mul(m, base, base);
+        exp >>= 1;
+    }
+    return result;
+}
+
+/*--------------------------------------------------------------------*/
+// PRIMALITY
+
+// Primes below 2^10, used for trial division and as a primality fast path
+const uint16_t small_primes[] = {
+    2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67,
+    71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131, 137, 139, 149,
+    151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223, 227, 229,
+    233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311, 313,
+    317, 331, 337, 347, 349, 353, 359, 367, 373, 379, 383, 389, 397, 401, 409,
+    419, 421, 431, 433, 439, 443, 449, 457, 461, 463, 467, 479, 487, 491, 499,
+    503, 509, 521, 523, 541, 547, 557, 563, 569, 571, 577, 587, 593, 599, 601,
+    607, 613, 617, 619, 631, 641, 643, 647, 653, 659, 661, 673, 677, 683, 691,
+    701, 709, 719, 727, 733, 739, 743, 751, 757, 761, 769, 773, 787, 797, 809,
+    811, 821, 823, 827, 829, 839, 853, 857, 859, 863, 877, 881, 883, 887, 907,
+    911, 919, 929, 937, 941, 947, 953, 967, 971, 977, 983, 991, 997, 1009,
+    1013, 1019, 1021
+};
+#define SMALL_PRIME_COUNT (sizeof(small_primes) / sizeof(small_primes[0]))
+#define SMALL_PRIME_LIMIT 1024
+
+// Deterministic Miller-Rabin: these seven bases have no common strong
+// pseudoprime below 2^64 (Jim Sinclair)
+const uint64_t miller_rabin_bases[] = { 2, 325, 9375, 28178, 450775, 9780504, 1795265022 };
+
+int is_prime_u64 (uint64_t n) {
+    if (n < 2) return 0;
+    for (size_t ii = 0; ii < SMALL_PRIME_COUNT; ii++) {
+        if (n == small_primes[ii]) return 1;
+        if (n % small_primes[ii] == 0) return 0;
+    }
+    if (n < (uint64_t) SMALL_PRIME_LIMIT * SMALL_PRIME_LIMIT) return 1;
+
+    montgomery m;
+    montgomery_init(&m, n);
+    uint64_t minus_one = n - m.one;
+
+    uint64_t d = n - 1;
+    int s = __builtin_ctzll(d);
+    d >>= s;
+
+    for (size_t ii = 0; ii < sizeof(miller_rabin_bases) / sizeof(uint64_t); ii++) {
+        uint64_t a = miller_rabin_bases[ii] % n;
+        if (a == 0) continue;
+
+        uint64_t x = montgomery_pow(&m, montgomery_to(&m, a), d);
+        if (x == m.one || x == minus_one) continue;
+
+        int witness = 1;
+        for (int r = 1; r < s; r++) {
+            x = montgomery_mul(&m, x, x);
+            if (x == minus_one) {
+                witness = 0;
+                break;
+            }
+        }
+        if (witness) return 0;
+    }
+
+    return 1;
+}
+
+/*--------------------------------------------------------------------*/
+// FACTORING
+
+uint64_t gcd_u64 (uint64_t a, uint64_t b) {
+    while (b != 0) {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Brent's variant of Pollard rho, iterating x -> x^2 + c in Montgomery form
+// Returns a nontrivial factor of the odd composite n
+uint64_t pollard_brent (uint64_t n) {
+    montgomery m;
+    montgomery_init(&m, n);
+    const uint64_t batch = 128;
+
+    for (uint64_t c = 1; ; c++) {
+        uint64_t cm = montgomery_to(&m, c);
+        uint64_t y = montgomery_to(&m, 2);
+        uint64_t x = y;
+        uint64_t ys = y;
+        uint64_t q = m.one;
+        uint64_t g = 1;
+
+        for (uint64_t r = 1; g == 1; r <<= 1) {
+            x = y;
+            for (uint64_t ii = 0; ii < r; ii++) {
+                y = montgomery_add(&m, montgomery_mul(&m, y, y), cm);
+            }
+
+            // Multiply |x - y| over a batch of steps so only one gcd is needed per batch
+            for (uint64_t k = 0; k < r && g == 1; k += batch) {
+                ys = y;
+                uint64_t steps = r - k < batch ? r - k : batch;
+                for (uint64_t ii = 0; ii < steps; ii++) {
+                    y = montgomery_add(&m, montgomery_mul(&m, y, y), cm);
+                    q = montgomery_mul(&m, q, x > y ? x - y : y - x);
+                }
+                g = gcd_u64(q, n);
+            }
+        }
+
+        // The batch overshot the cycle; step back through it one at a time
+        if (g == n) {
+            do {
+                ys = montgomery_add(&m, montgomery_mul(&m, ys, ys), cm);
+                g = gcd_u64(x > ys ? x - ys : ys - x, n);
+            } while (g == 1);
+        }
+
+        if (g != n) return g;
+    }
+}
+
+void factor_u64_rec (uint64_t n, uint64_t* factors, int* count) {
+    if (n == 1) return;
+    if (is_prime_u64(n)) {
+        factors[(*count)++] = n;
+        return;
+    }
+
+    uint64_t d = pollard_brent(n);
+    factor_u64_rec(d, factors, count);
+    factor_u64_rec(n / d, factors, count);
+}
+
+int compare_u64 (const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+// Fills factors with the prime factors of n (n >= 2) in ascending order,
+// repeated according to multiplicity, and returns how many were written
+int factor_u64 (uint64_t n, uint64_t* factors) {
+    int count = 0;
+
+    for (size_t ii = 0; ii < SMALL_PRIME_COUNT && n > 1; ii++) {
+        uint64_t p = small_primes[ii];
+        if (p * p > n) break;
+        while (n % p == 0) {
+            factors[count++] = p;
+            n /= p;
+        }
+    }
+
+    // Everything left is either 1, prime, or has only factors above the table
+    if (n > 1) factor_u64_rec(n, factors, &count);
+
+    qsort(factors, count, sizeof(uint64_t), compare_u64);
+    return count;
+}
@@ -0,0 +1,10 @@
+#include <stdint.h>
+
+// In-process factoring for values that fit in a machine word, used instead
+// of msieve for the many small composites in a solsys tree.
+
+// A uint64_t has at most 64 prime factors (counted with multiplicity)
+#define FACTOR64_MAX 64
+
+int is_prime_u64(uint64_t n);
+int factor_u64(uint64_t n, uint64_t* factors);
@@ -1,145 +1,259 @@
-//This is a logarithmic integral function lifted directly from primecount's own logarithmic integral code. It is fully precise in the larger ranges it is designed to operate in (>1e13) thanks to 512-bit floating point formats provided by mpfr.
-#include "li.h"
-
-// CONSTANTS
-mpfr_t GAMMA;
-mpfr_t LI2;
-mpfr_t LIMIT;
-
-// USED DURING A CALCULATION
-mpfr_t sum;
-mpfr_t inner_sum;
-mpfr_t inner_increment;
-mpfr_t factorial;
-mpfr_t p;
-mpfr_t q;
-mpfr_t power2;
-mpfr_t term;
-mpfr_t abs_term;
-int k;
-mpfr_t logx;
-mpfr_t sqrtx;
-mpfr_t result;
-
-void logint_mpfr (mpfr_t output, mpfr_t x) {
-    if (mpfr_cmp_ui (x, 2) >= 0) {
-        mpfr_set_si (sum, 0, MPFR_RNDN);
-        mpfr_set_si (inner_sum, 0, MPFR_RNDN);
-        mpfr_set_si (inner_increment, 1, MPFR_RNDN);
-        mpfr_set_si (factorial, 1, MPFR_RNDN);
-        mpfr_set_si (p, -1, MPFR_RNDN);
-        mpfr_set_si (q, 0, MPFR_RNDN);
-        mpfr_set_si (power2, 1, MPFR_RNDN);
-        mpfr_set_si (term, 0, MPFR_RNDN);
-        mpfr_set_si (abs_term, 0, MPFR_RNDN);
-
-        mpfr_set_ui (logx, 0, MPFR_RNDN);
-        mpfr_log(logx, x, MPFR_RNDN);
-
-        mpfr_set_ui (sqrtx, 0, MPFR_RNDN);
-        mpfr_sqrt(sqrtx, x, MPFR_RNDN);
-
-        int k = 0;
-        for (int n = 1; n < 200; n++) {
-            mpfr_mul (p, p, logx, MPFR_RNDN);
-            mpfr_neg (p, p, MPFR_RNDN);
-            mpfr_mul_si (factorial, factorial, n, MPFR_RNDN);
-            mpfr_mul (q, factorial, power2, MPFR_RNDN);
-            mpfr_mul_si (power2, power2, 2, MPFR_RNDN);
-            for (; k <= (n - 1) / 2; k++) {
-                mpfr_set_ui (inner_increment, 1, MPFR_RNDN);
-                mpfr_div_ui (inner_increment, inner_increment, 2 * k + 1, MPFR_RNDN);
-                mpfr_add (inner_sum, inner_sum, inner_increment, MPFR_RNDN);
-            }
-            mpfr_div (term, p, q, MPFR_RNDN);
-            mpfr_mul (term, term, inner_sum, MPFR_RNDN);
-            mpfr_add (sum, sum, term, MPFR_RNDN);
-            mpfr_abs (abs_term, term, MPFR_RNDN);
-            if (mpfr_cmp (abs_term, LIMIT) < 0)
-                break;
-        }
-
-        mpfr_set_si (result, 0, MPFR_RNDN);
-        mpfr_mul (result, sqrtx, sum, MPFR_RNDN);
-        mpfr_log (logx, logx, MPFR_RNDN);
-        mpfr_add (result, result, logx, MPFR_RNDN);
-        mpfr_add (result, result, GAMMA, MPFR_RNDN);
-        mpfr_sub (result, result, LI2, MPFR_RNDN);
-        mpfr_floor (result, result);
-
-        mpfr_set (output, result, MPFR_RNDN);
-    } else {
-        mpfr_set_ui (output, 0, MPFR_RNDN);
-    }
-}
-
-void logint_initialize () {
-    mpfr_inits2(
-        512,
-        GAMMA,
-        LI2,
-        LIMIT,
-
-        sum,
-        inner_sum,
-        inner_increment,
-        factorial,
-        p,
-        q,
-        power2,
-        term,
-        abs_term,
-        
-        logx,
-        sqrtx,
-        result,
-        (mpfr_ptr) 0
-    );
-
-    mpfr_set_str(GAMMA, "0.577215664901532860606512090082402431042159335939923598805767234884867726777664670936947063291746749", 10, MPFR_RNDN);
-    mpfr_set_str(LI2, "1.04516378011749278484458888919461313652261557815120157583290914407501320521035953017271740562638335630602", 10, MPFR_RNDN);
-    mpfr_set_str(LIMIT, "0.000000000000000000000000000000000000000000000000001", 10, MPFR_RNDN);
-}
-
-void logint_free () {
-    mpfr_clears(
-        GAMMA,
-        LI2,
-        LIMIT,
-
-        sum,
-        inner_sum,
-        inner_increment,
-        factorial,
-        p,
-        q,
-        power2,
-        term,
-        abs_term,
-        
-        logx,
-        sqrtx,
-        result,
-        (mpfr_ptr) 0
-    );
-
-    mpfr_free_cache();
-}
-
-char * logint (char * input) {
-    mpfr_t x;
-    mpfr_t output;
-
-    mpfr_init_set_ui (x, 0, MPFR_RNDN);
-    mpfr_set_str (x, input, 10, MPFR_RNDN);
-    mpfr_init_set_ui (output, 0, MPFR_RNDN);
-
-    logint_mpfr (output, x);
-    char* buf;
-    mpfr_asprintf(&buf, "%.0Rf", output);
-
-    mpfr_clear(x);
-    mpfr_clear(output);
-
-    return buf;
-}
+//This is a logarithmic integral function lifted directly from primecount's own logarithmic integral code. It is fully precise in the larger ranges it is designed to operate in (>1e13), with the working precision sized to each x by mpfr.
+#include "li.h"
+#include <string.h>
+#include <inttypes.h>
+
+// Ramanujan's series for li(x), at the state's current precision and without
+// rounding. The terms grow to about x before they cancel, so the precision
+// must cover x's own bits on top of the bits wanted after the point.
+void logint_series (logint_state * s, mpfr_t output, mpfr_t x) {
+    mpfr_set_si (s->sum, 0, MPFR_RNDN);
+    mpfr_set_si (s->inner_sum, 0, MPFR_RNDN);
+    mpfr_set_si (s->factorial, 1, MPFR_RNDN);
+    mpfr_set_si (s->p, -1, MPFR_RNDN);
+    mpfr_set_si (s->power2, 1, MPFR_RNDN);
+
+    mpfr_log (s->logx, x, MPFR_RNDN);
+    mpfr_sqrt (s->sqrtx, x, MPFR_RNDN);
+
+    // The sum is scaled by sqrt(x) at the end, so a term may be dropped once
+    // it is below 2^-GUARD / sqrt(x). The terms alternate in sign and shrink
+    // after their peak, so the first dropped term bounds the error.
+    mpfr_exp_t cutoff = -(mpfr_get_exp (s->sqrtx) + LOGINT_GUARD_BITS);
+    long max_terms = 8 * mpfr_get_prec (s->sum) + 64;
+
+    int k = 0;
+    for (long n = 1; n < max_terms; n++) {
+        mpfr_mul (s->p, s->p, s->logx, MPFR_RNDN);
+        mpfr_neg (s->p, s->p, MPFR_RNDN);
+        mpfr_mul_si (s->factorial, s->factorial, n, MPFR_RNDN);
+        mpfr_mul (s->q, s->factorial, s->power2, MPFR_RNDN);
+        mpfr_mul_si (s->power2, s->power2, 2, MPFR_RNDN);
+        for (; k <= (n - 1) / 2; k++) {
+            mpfr_set_ui (s->inner_increment, 1, MPFR_RNDN);
+            mpfr_div_ui (s->inner_increment, s->inner_increment, 2 * k + 1, MPFR_RNDN);
+            mpfr_add (s->inner_sum, s->inner_sum, s->inner_increment, MPFR_RNDN);
+        }
+        mpfr_div (s->term, s->p, s->q, MPFR_RNDN);
+        mpfr_mul (s->term, s->term, s->inner_sum, MPFR_RNDN);
+        mpfr_add (s->sum, s->sum, s->term, MPFR_RNDN);
+        if (mpfr_zero_p (s->term) || mpfr_get_exp (s->term) < cutoff)
+            break;
+    }
+
+    mpfr_mul (output, s->sqrtx, s->sum, MPFR_RNDN);
+    mpfr_log (s->logx, s->logx, MPFR_RNDN);
+    mpfr_add (output, output, s->logx, MPFR_RNDN);
+    mpfr_add (output, output, s->GAMMA, MPFR_RNDN);
+}
+
+// Sizes the working variables for a calculation, refreshing the constants
+// first if they are not yet precise enough
+void logint_set_precision (logint_state * s, mpfr_prec_t precision) {
+    mpfr_set_prec (s->sum, precision);
+    mpfr_set_prec (s->inner_sum, precision);
+    mpfr_set_prec (s->inner_increment, precision);
+    mpfr_set_prec (s->factorial, precision);
+    mpfr_set_prec (s->p, precision);
+    mpfr_set_prec (s->q, precision);
+    mpfr_set_prec (s->power2, precision);
+    mpfr_set_prec (s->term, precision);
+    mpfr_set_prec (s->logx, precision);
+    mpfr_set_prec (s->sqrtx, precision);
+    mpfr_set_prec (s->result, precision);
+
+    if (precision > s->constant_precision) {
+        mpfr_set_prec (s->GAMMA, precision);
+        mpfr_const_euler (s->GAMMA, MPFR_RNDN);
+
+        // li(2) comes from the same series, at the new precision
+        mpfr_t two;
+        mpfr_init2 (two, 2);
+        mpfr_set_ui (two, 2, MPFR_RNDN);
+        mpfr_set_prec (s->LI2, precision);
+        logint_series (s, s->LI2, two);
+        mpfr_clear (two);
+
+        s->constant_precision = precision;
+    }
+}
+
+// floor(li(x) - li(2)), or 0 below 2
+void logint_mpfr (logint_state * s, mpfr_t output, mpfr_t x) {
+    if (mpfr_cmp_ui (x, 2) >= 0) {
+        logint_set_precision (s, mpfr_get_exp (x) + LOGINT_GUARD_BITS);
+
+        logint_series (s, s->result, x);
+        mpfr_sub (s->result, s->result, s->LI2, MPFR_RNDN);
+        mpfr_floor (s->result, s->result);
+
+        mpfr_set (output, s->result, MPFR_RNDN);
+    } else {
+        mpfr_set_ui (output, 0, MPFR_RNDN);
+    }
+}
+
+logint_state * logint_initialize () {
+    logint_state * s = malloc(sizeof(logint_state));
+    mpfr_inits2(
+        MPFR_PREC_MIN,
+        s->GAMMA,
+        s->LI2,
+
+        s->sum,
+        s->inner_sum,
+        s->inner_increment,
+        s->factorial,
+        s->p,
+        s->q,
+        s->power2,
+        s->term,
+
+        s->logx,
+        s->sqrtx,
+        s->result,
+        (mpfr_ptr) 0
+    );
+    s->constant_precision = 0;
+    s->next = NULL;
+
+    return s;
+}
+
+void logint_free (logint_state * s) {
+    if (s == NULL) return;
+    mpfr_clears(
+        s->GAMMA,
+        s->LI2,
+
+        s->sum,
+        s->inner_sum,
+        s->inner_increment,
+        s->factorial,
+        s->p,
+        s->q,
+        s->power2,
+        s->term,
+
+        s->logx,
+        s->sqrtx,
+        s->result,
+        (mpfr_ptr) 0
+    );
+    free(s);
+
+    mpfr_free_cache();
+}
+
+// Outputs are whole numbers that fit in the precision of x, so x's precision
+// is enough to hold the result exactly
+char * logint (logint_state * s, char * input) {
+    // Plain decimals under 2^60 go to the double-double kernel first
+    size_t digits = strspn(input, "0123456789");
+    if (digits > 0 && digits <= 18 && input[digits] == '\0') {
+        int64_t fast = logint_fast(strtoull(input, NULL, 10));
+        if (fast >= 0) {
+            char buf[24];
+            snprintf(buf, sizeof(buf), "%" PRId64, fast);
+            return strdup(buf);
+        }
+    }
+
+    mpfr_t x;
+    mpfr_t output;
+
+    // Each decimal digit needs under 3.33 bits
+    mpfr_prec_t precision = 4 * strlen(input) + 8;
+    mpfr_init2 (x, precision);
+    mpfr_set_str (x, input, 10, MPFR_RNDN);
+    mpfr_init2 (output, precision);
+
+    logint_mpfr (s, output, x);
+    // mpfr's strings come from GMP's allocator, so hand back a malloc'd copy
+    char* str;
+    mpfr_asprintf(&str, "%.0Rf", output);
+    char* buf = strdup(str);
+    mpfr_free_str(str);
+
+    mpfr_clear(x);
+    mpfr_clear(output);
+
+    return buf;
+}
+
+// As logint, for callers that already hold x as an integer
+void logint_z (logint_state * s, mpz_t result, mpz_t input) {
+    if (mpz_sgn(input) >= 0 && mpz_sizeinbase(input, 2) <= 60) {
+        int64_t fast = logint_fast(mpz_get_ui(input));
+        if (fast >= 0) {
+            mpz_set_ui(result, fast);
+            return;
+        }
+    }
+
+    mpfr_t x;
+    mpfr_t output;
+
+    mpfr_prec_t precision = mpz_sizeinbase (input, 2) + 8;
+    mpfr_init2 (x, precision);
+    mpfr_set_z (x, input, MPFR_RNDN);
+    mpfr_init2 (output, precision);
+
+    logint_mpfr (s, output, x);
+    mpfr_get_z (result, output, MPFR_RNDN);
+
+    mpfr_clear(x);
+    mpfr_clear(output);
+}
+
+/*--------------------------------------------------------------------*/
+// ENGINES
+
+logint_engine * logint_engine_create () {
+    logint_engine * e = malloc(sizeof(logint_engine));
+    pthread_mutex_init(&e->lock, NULL);
+    e->idle = NULL;
+    return e;
+}
+
+void logint_engine_free (logint_engine * e) {
+    if (e == NULL) return;
+    while (e->idle != NULL) {
+        logint_state * next = e->idle->next;
+        logint_free(e->idle);
+        e->idle = next;
+    }
+    pthread_mutex_destroy(&e->lock);
+    free(e);
+}
+
+// Takes an idle state, or makes one if every state is in use; the engine
+// only ever holds as many states as there have been concurrent callers
+logint_state * logint_acquire (logint_engine * e) {
+    pthread_mutex_lock(&e->lock);
+    logint_state * s = e->idle;
+    if (s != NULL) e->idle = s->next;
+    pthread_mutex_unlock(&e->lock);
+
+    return s != NULL ? s : logint_initialize();
+}
+
+void logint_release (logint_engine * e, logint_state * s) {
+    pthread_mutex_lock(&e->lock);
+    s->next = e->idle;
+    e->idle = s;
+    pthread_mutex_unlock(&e->lock);
+}
+
+void logint_engine_z (logint_engine * e, mpz_t result, mpz_t input) {
+    logint_state * s = logint_acquire(e);
+    logint_z(s, result, input);
+    logint_release(e, s);
+}
+
+char * logint_engine_str (logint_engine * e, char * input) {
+    logint_state * s = logint_acquire(e);
+    char * result = logint(s, input);
+    logint_release(e, s);
+    return result;
+}
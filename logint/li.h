@@ -2,7 +2,69 @@
 #include <gmp.h>
 #include <mpfr.h>
 #include <malloc.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdint.h>
 
-char * logint (char * input);
-void logint_initialize ();
-void logint_free ();
+// Bits kept beyond the size of x, so rounding error stays far below the
+// distance floor(li(x)) is taken from
+#define LOGINT_GUARD_BITS 64
+
+// The double-double kernel in li_fast.c takes x below LOGINT_FAST_BOUND. For
+// those x its rounding error stays under 2^-28 (about n^2 ulps of the largest
+// series term, scaled by sqrt(x)) and truncation under 2^-40, so any result
+// further than LOGINT_FAST_MARGIN from an integer has a certain floor.
+#define LOGINT_FAST_BOUND ((uint64_t) 1 << 60)
+#define LOGINT_FAST_MARGIN 0x1p-20
+#define LOGINT_FAST_LANES 2
+
+// Working variables for one calculation at a time. Their precision follows
+// the x being evaluated; the constants are kept at the highest precision any
+// calculation on this state has needed so far.
+typedef struct logint_state {
+    // CONSTANTS
+    mpfr_t GAMMA;
+    mpfr_t LI2;
+    mpfr_prec_t constant_precision;
+
+    // USED DURING A CALCULATION
+    mpfr_t sum;
+    mpfr_t inner_sum;
+    mpfr_t inner_increment;
+    mpfr_t factorial;
+    mpfr_t p;
+    mpfr_t q;
+    mpfr_t power2;
+    mpfr_t term;
+    mpfr_t logx;
+    mpfr_t sqrtx;
+    mpfr_t result;
+
+    // Next idle state in an engine
+    struct logint_state* next;
+} logint_state;
+
+// Hands out one state per concurrent caller, so any number of threads can
+// evaluate li at once without sharing working variables
+typedef struct logint_engine {
+    pthread_mutex_t lock;
+    logint_state* idle;
+} logint_engine;
+
+logint_engine * logint_engine_create ();
+void logint_engine_free (logint_engine * e);
+logint_state * logint_acquire (logint_engine * e);
+void logint_release (logint_engine * e, logint_state * s);
+void logint_engine_z (logint_engine * e, mpz_t result, mpz_t input);
+char * logint_engine_str (logint_engine * e, char * input);
+
+int64_t logint_fast (uint64_t x);
+void logint_fast_batch (const uint64_t * xs, int64_t * results, size_t count);
+
+char * logint (logint_state * s, char * input);
+void logint_z (logint_state * s, mpz_t result, mpz_t input);
+void logint_mpfr (logint_state * s, mpfr_t output, mpfr_t x);
+void logint_series (logint_state * s, mpfr_t output, mpfr_t x);
+void logint_set_precision (logint_state * s, mpfr_prec_t precision);
+logint_state * logint_initialize ();
+void logint_free (logint_state * s);
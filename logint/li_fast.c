@@ -0,0 +1,253 @@
+// li(x) for word-sized x in double-double arithmetic: each value is an
+// unevaluated sum hi + lo of two doubles, good for about 106 bits. Every
+// operation works on LOGINT_FAST_LANES values at once through GCC's vector
+// extensions (two lanes fill an SSE2 register), so a batch of x costs little
+// more than a single one.
+#include "li.h"
+#include <math.h>
+#include <string.h>
+
+typedef double lanes __attribute__ ((vector_size (LOGINT_FAST_LANES * sizeof(double))));
+
+typedef struct dd {
+    lanes hi;
+    lanes lo;
+} dd;
+
+/*--------------------------------------------------------------------*/
+// DOUBLE-DOUBLE ARITHMETIC
+
+static inline lanes broadcast (double v) {
+    lanes r;
+    for (int ii = 0; ii < LOGINT_FAST_LANES; ii++) r[ii] = v;
+    return r;
+}
+
+static inline dd dd_const (double hi, double lo) {
+    dd r = { broadcast(hi), broadcast(lo) };
+    return r;
+}
+
+// a + b exactly, as a rounded sum and its error
+static inline dd two_sum (lanes a, lanes b) {
+    dd r;
+    r.hi = a + b;
+    lanes bb = r.hi - a;
+    r.lo = (a - (r.hi - bb)) + (b - bb);
+    return r;
+}
+
+// As two_sum, when |a| >= |b|
+static inline dd quick_two_sum (lanes a, lanes b) {
+    dd r;
+    r.hi = a + b;
+    r.lo = b - (r.hi - a);
+    return r;
+}
+
+// a * b exactly, splitting each factor into 26-bit halves (Dekker), so no
+// fused multiply-add is needed
+static inline dd two_prod (lanes a, lanes b) {
+    const lanes split = broadcast(134217729.0);
+    lanes ca = split * a;
+    lanes a_hi = ca - (ca - a);
+    lanes a_lo = a - a_hi;
+    lanes cb = split * b;
+    lanes b_hi = cb - (cb - b);
+    lanes b_lo = b - b_hi;
+
+    dd r;
+    r.hi = a * b;
+    r.lo = ((a_hi * b_hi - r.hi) + a_hi * b_lo + a_lo * b_hi) + a_lo * b_lo;
+    return r;
+}
+
+static inline dd dd_add (dd a, dd b) {
+    dd s = two_sum(a.hi, b.hi);
+    dd t = two_sum(a.lo, b.lo);
+    s.lo += t.hi;
+    s = quick_two_sum(s.hi, s.lo);
+    s.lo += t.lo;
+    return quick_two_sum(s.hi, s.lo);
+}
+
+static inline dd dd_neg (dd a) {
+    dd r = { -a.hi, -a.lo };
+    return r;
+}
+
+static inline dd dd_mul (dd a, dd b) {
+    dd p = two_prod(a.hi, b.hi);
+    p.lo += a.hi * b.lo + a.lo * b.hi;
+    return quick_two_sum(p.hi, p.lo);
+}
+
+static inline dd dd_mul_d (dd a, lanes b) {
+    dd p = two_prod(a.hi, b);
+    p.lo += a.lo * b;
+    return quick_two_sum(p.hi, p.lo);
+}
+
+static inline dd dd_div_d (dd a, lanes b) {
+    lanes q = a.hi / b;
+    dd p = two_prod(q, b);
+    lanes r = ((a.hi - p.hi) - p.lo + a.lo) / b;
+    return quick_two_sum(q, r);
+}
+
+// Long division, one double of the quotient at a time
+static inline dd dd_div (dd a, dd b) {
+    lanes q1 = a.hi / b.hi;
+    dd r = dd_add(a, dd_neg(dd_mul_d(b, q1)));
+    lanes q2 = r.hi / b.hi;
+    r = dd_add(r, dd_neg(dd_mul_d(b, q2)));
+    lanes q3 = r.hi / b.hi;
+
+    dd q = quick_two_sum(q1, q2);
+    dd c = { q3, broadcast(0) };
+    return dd_add(q, c);
+}
+
+// One Newton step from the double square root doubles its precision
+static inline dd dd_sqrt (dd a) {
+    lanes q;
+    for (int ii = 0; ii < LOGINT_FAST_LANES; ii++) q[ii] = sqrt(a.hi[ii]);
+    dd p = two_prod(q, q);
+    lanes r = ((a.hi - p.hi) - p.lo + a.lo) / (2 * q);
+    return quick_two_sum(q, r);
+}
+
+// ln(a) = e ln 2 + ln m with m = a / 2^e in [sqrt(1/2), sqrt(2)), and
+// ln m = 2 atanh(s) for s = (m - 1) / (m + 1). With |s| < 0.172 the atanh
+// series gains 5 bits a term, so 22 terms cover the 106 bits.
+static inline dd dd_log (dd a) {
+    lanes e;
+    dd m;
+    for (int ii = 0; ii < LOGINT_FAST_LANES; ii++) {
+        int exponent;
+        double fraction = frexp(a.hi[ii], &exponent);
+        if (fraction < M_SQRT1_2) exponent--;
+        e[ii] = exponent;
+        m.hi[ii] = ldexp(a.hi[ii], -exponent);
+        m.lo[ii] = ldexp(a.lo[ii], -exponent);
+    }
+
+    const dd one = dd_const(1, 0);
+    dd s = dd_div(dd_add(m, dd_neg(one)), dd_add(m, one));
+    dd t = dd_mul(s, s);
+
+    int terms = 22;
+    dd series = dd_div_d(one, broadcast(2 * terms + 1));
+    for (int k = terms - 1; k >= 0; k--) {
+        series = dd_add(dd_mul(series, t), dd_div_d(one, broadcast(2 * k + 1)));
+    }
+    series = dd_mul(series, s);
+    series.hi *= 2;
+    series.lo *= 2;
+
+    const dd ln2 = dd_const(0.6931471805599453, 2.3190468138462996e-17);
+    return dd_add(dd_mul_d(ln2, e), series);
+}
+
+/*--------------------------------------------------------------------*/
+// KERNEL
+
+// Ramanujan's series, as in logint_series, for one vector of x:
+//   li(x) = gamma + ln ln x + sqrt(x) sum_n (-1)^(n-1) a_n inner_n
+// with a_n = (ln x)^n / (n! 2^(n-1)) and inner_n = sum_{k <= (n-1)/2} 1/(2k+1).
+static dd logint_fast_lanes (dd x) {
+    dd logx = dd_log(x);
+    dd sqrtx = dd_sqrt(x);
+    const dd one = dd_const(1, 0);
+
+    // a_n carries the sign of its term, and each term must drop below
+    // 2^-40 / sqrt(x) in every lane before the sum stops
+    dd a = logx;
+    dd inner = one;
+    dd sum = logx;
+    lanes cutoff = broadcast(0x1p-40) / sqrtx.hi;
+
+    int k = 1;
+    for (int n = 2; n < 256; n++) {
+        a = dd_div_d(dd_mul(a, logx), broadcast(-2.0 * n));
+        if (k <= (n - 1) / 2) {
+            inner = dd_add(inner, dd_div_d(one, broadcast(2 * k + 1)));
+            k++;
+        }
+        dd term = dd_mul(a, inner);
+        sum = dd_add(sum, term);
+
+        int converged = 1;
+        for (int ii = 0; ii < LOGINT_FAST_LANES; ii++) {
+            if (fabs(term.hi[ii]) >= cutoff[ii]) converged = 0;
+        }
+        if (converged) break;
+    }
+
+    const dd gamma = dd_const(0.5772156649015329, -4.942915152430645e-18);
+    const dd li2 = dd_const(1.045163780117493, -1.0616403481185999e-16);
+    dd result = dd_mul(sqrtx, sum);
+    result = dd_add(result, dd_log(logx));
+    result = dd_add(result, gamma);
+    return dd_add(result, dd_neg(li2));
+}
+
+// Past 2^53 a double holds only even integers, so split x exactly
+static inline void split_u64 (uint64_t x, double* hi, double* lo) {
+    *hi = (double) x;
+    *lo = (double) (int64_t) (x - (uint64_t) *hi);
+}
+
+// floor(hi + lo), or -1 if hi + lo is within the kernel's error bound of an
+// integer and the floor could go either way
+static int64_t certified_floor (double hi, double lo) {
+    double base = floor(hi);
+    int64_t result = (int64_t) base;
+    double fraction = (hi - base) + lo;
+    while (fraction < 0) {
+        fraction += 1;
+        result--;
+    }
+    while (fraction >= 1) {
+        fraction -= 1;
+        result++;
+    }
+
+    if (fraction < LOGINT_FAST_MARGIN || fraction > 1 - LOGINT_FAST_MARGIN) return -1;
+    return result;
+}
+
+// Sets results[i] to floor(li(xs[i]) - li(2)): 0 up to 2, and -1 where the
+// kernel cannot decide the floor (or xs[i] >= LOGINT_FAST_BOUND), so the
+// caller can take the MPFR path for just those values
+void logint_fast_batch (const uint64_t * xs, int64_t * results, size_t count) {
+    for (size_t base = 0; base < count; base += LOGINT_FAST_LANES) {
+        // Spare lanes of the last vector evaluate a harmless x = 2
+        dd x;
+        for (int ii = 0; ii < LOGINT_FAST_LANES; ii++) {
+            uint64_t value = base + ii < count ? xs[base + ii] : 2;
+            if (value < 2 || value >= LOGINT_FAST_BOUND) value = 2;
+            split_u64(value, &x.hi[ii], &x.lo[ii]);
+        }
+
+        dd li = logint_fast_lanes(x);
+
+        for (int ii = 0; ii < LOGINT_FAST_LANES && base + ii < count; ii++) {
+            uint64_t value = xs[base + ii];
+            // li(2) - li(2) is exactly 0, but sits on an integer
+            if (value <= 2) {
+                results[base + ii] = 0;
+            } else if (value >= LOGINT_FAST_BOUND) {
+                results[base + ii] = -1;
+            } else {
+                results[base + ii] = certified_floor(li.hi[ii], li.lo[ii]);
+            }
+        }
+    }
+}
+
+int64_t logint_fast (uint64_t x) {
+    int64_t result;
+    logint_fast_batch(&x, &result, 1);
+    return result;
+}
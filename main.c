@@ -1,12 +1,5 @@
 #include "main.h"
 
-int G_DEBUG = 0;
-int seed1;
-int seed2;
-
-mpz_t factorization_threshold;
-mpz_t logint_threshold;
-
 enum demotype { flag_recursive, flag_factorization, flag_primecount, flag_logint, flag_logint_err };
 
 int main(int argc, char** argv) {
@@ -16,13 +9,16 @@ int main(int argc, char** argv) {
         exit(1);
     }
 
-    mpz_init(factorization_threshold);
-    mpz_set_str(factorization_threshold, "1", 0);
-    mpz_init(logint_threshold);
-    mpz_set_str(logint_threshold, "10000000000000", 0);
+    solsys_options options;
+    solsys_default_options(&options);
 
     // Detect flags
     enum demotype flag = flag_recursive;
+    int serve_mode = 0;
+    int range_mode = 0;
+    char* batch_path = NULL;
+    uint64_t range_a = 0, range_b = 0;
+    enum output_format format = output_tree;
     for (int ii = 1; ii < argc; ii++) {
         if (streq("-r", argv[ii]) || streq("--recursive", argv[ii])) {
             flag = flag_recursive;
@@ -33,7 +29,104 @@ int main(int argc, char** argv) {
         } else if (streq("-t", argv[ii]) || streq("--threshold", argv[ii])) {
             argv[ii] = NULL;
             ii++;
-            mpz_set_str(factorization_threshold, argv[ii], 0);
+            options.factorization_threshold = argv[ii];
+            argv[ii] = NULL;
+        } else if (streq("--logint-threshold", argv[ii])) {
+            argv[ii] = NULL;
+            ii++;
+            options.logint_threshold = argv[ii];
+            argv[ii] = NULL;
+        } else if (streq("--exact-limit", argv[ii])) {
+            argv[ii] = NULL;
+            ii++;
+            options.exact_limit = argv[ii];
+            argv[ii] = NULL;
+        } else if (streq("--exact-budget-ms", argv[ii])) {
+            argv[ii] = NULL;
+            ii++;
+            options.exact_budget_ms = atol(argv[ii]);
+            argv[ii] = NULL;
+        } else if (streq("--primecount-threads", argv[ii])) {
+            argv[ii] = NULL;
+            ii++;
+            options.primecount_threads = atoi(argv[ii]);
+            argv[ii] = NULL;
+        } else if (streq("--deadline-ms", argv[ii])) {
+            argv[ii] = NULL;
+            ii++;
+            options.deadline_ms = atol(argv[ii]);
+            argv[ii] = NULL;
+        } else if (streq("--schedule", argv[ii])) {
+            argv[ii] = NULL;
+            ii++;
+            if (ii >= argc) {
+                fprintf(stderr, "ERROR: --schedule needs a policy.\n");
+                exit(1);
+            } else if (streq("fifo", argv[ii])) {
+                options.schedule = schedule_fifo;
+            } else if (streq("smallest", argv[ii])) {
+                options.schedule = schedule_smallest;
+            } else if (streq("breadth", argv[ii])) {
+                options.schedule = schedule_breadth;
+            } else {
+                fprintf(stderr, "ERROR: unknown schedule policy %s.\n", argv[ii]);
+                exit(1);
+            }
+            argv[ii] = NULL;
+        } else if (streq("--checkpoint", argv[ii])) {
+            argv[ii] = NULL;
+            ii++;
+            options.checkpoint_path = argv[ii];
+            argv[ii] = NULL;
+        } else if (streq("--resume", argv[ii])) {
+            argv[ii] = NULL;
+            ii++;
+            options.resume_path = argv[ii];
+            argv[ii] = NULL;
+        } else if (streq("--checkpoint-interval-ms", argv[ii])) {
+            argv[ii] = NULL;
+            ii++;
+            options.checkpoint_interval_ms = atol(argv[ii]);
+            argv[ii] = NULL;
+        } else if (streq("--savefile-dir", argv[ii])) {
+            argv[ii] = NULL;
+            ii++;
+            options.savefile_dir = argv[ii];
+            argv[ii] = NULL;
+        } else if (streq("--memory-savefile-digits", argv[ii])) {
+            argv[ii] = NULL;
+            ii++;
+            options.memory_savefile_digits = atoi(argv[ii]);
+            argv[ii] = NULL;
+        } else if (streq("--stats", argv[ii])) {
+            options.stats = 1;
+            argv[ii] = NULL;
+        } else if (streq("--trace", argv[ii])) {
+            argv[ii] = NULL;
+            ii++;
+            options.trace_path = argv[ii];
+            argv[ii] = NULL;
+        } else if (streq("-c", argv[ii]) || streq("--cache-file", argv[ii])) {
+            argv[ii] = NULL;
+            ii++;
+            options.cache_file = argv[ii];
+            argv[ii] = NULL;
+        } else if (streq("--pi-table", argv[ii])) {
+            argv[ii] = NULL;
+            ii++;
+            options.pi_table_enabled = 1;
+            options.pi_table_path = argv[ii];
+            argv[ii] = NULL;
+        } else if (streq("--pi-table-bound", argv[ii])) {
+            argv[ii] = NULL;
+            ii++;
+            options.pi_table_enabled = 1;
+            options.pi_table_bound = strtoull(argv[ii], NULL, 0);
+            argv[ii] = NULL;
+        } else if (streq("-j", argv[ii]) || streq("--threads", argv[ii])) {
+            argv[ii] = NULL;
+            ii++;
+            options.threads = atoi(argv[ii]);
             argv[ii] = NULL;
         } else if (streq("-p", argv[ii]) || streq("--primecount", argv[ii])) {
             flag = flag_primecount;
@@ -47,61 +140,119 @@ int main(int argc, char** argv) {
         } else if (streq("-h", argv[ii]) || streq("--help", argv[ii])) {
             print_help(*argv);
             exit(0);
+        } else if (streq("--shape", argv[ii])) {
+            format = output_shape;
+            argv[ii] = NULL;
+        } else if (streq("--shape-key", argv[ii])) {
+            format = output_shape_key;
+            argv[ii] = NULL;
+        } else if (streq("--dag", argv[ii])) {
+            format = output_dag;
+            argv[ii] = NULL;
+        } else if (streq("--compact", argv[ii])) {
+            options.compact = 1;
+            argv[ii] = NULL;
+        } else if (streq("--range", argv[ii])) {
+            argv[ii] = NULL;
+            range_mode = 1;
+            if (ii + 2 >= argc || !parse_u64(argv[ii + 1], &range_a) || !parse_u64(argv[ii + 2], &range_b)) {
+                fprintf(stderr, "ERROR: --range needs two numbers a and b.\n");
+                exit(1);
+            }
+            argv[++ii] = NULL;
+            argv[++ii] = NULL;
+        } else if (streq("-b", argv[ii]) || streq("--batch", argv[ii])) {
+            argv[ii] = NULL;
+            ii++;
+            batch_path = argv[ii];
+            argv[ii] = NULL;
+        } else if (streq("-s", argv[ii]) || streq("--serve", argv[ii])) {
+            serve_mode = 1;
+            argv[ii] = NULL;
         } else if (streq("-d", argv[ii]) || streq("--debug", argv[ii])) {
-            G_DEBUG = 1;
+            options.debug = 1;
             argv[ii] = NULL;
         }
     }
 
-    // Setup/report demo type
+    solsys_ctx* ctx = solsys_create(&options);
+    install_signal_handlers();
+
+    // Serve mode takes its numbers from stdin and keeps ctx warm between them
+    if (serve_mode) {
+        debug_log(ctx, "SERVE MODE\n");
+        serve(ctx);
+        solsys_destroy(ctx);
+        sieve_free();
+        return 0;
+    }
+
+    // Range mode builds a tree for every n in [a, b] instead of reading numbers
+    if (range_mode) {
+        if (range_a < 2 || range_a > range_b) {
+            fprintf(stderr, "ERROR: --range needs 2 <= a <= b.\n");
+            exit(1);
+        }
+        debug_log(ctx, "RANGE DEMO\n");
+        solsys_factor_range(ctx, range_a, range_b, print_range_tree, &format);
+        if (ctx->stats) solsys_stats_write(ctx, NULL, stderr);
+        solsys_destroy(ctx);
+        sieve_free();
+        return 0;
+    }
+
+    // Report demo type
     if (flag == flag_recursive) {
-        debug_log("RECURSIVE DEMO\n");
-        logint_initialize();
+        debug_log(ctx, "RECURSIVE DEMO\n");
     } else if (flag == flag_primecount) {
-        debug_log("PRIMECOUNT DEMO\n");
+        debug_log(ctx, "PRIMECOUNT DEMO\n");
     } else if (flag == flag_logint) {
-        debug_log("LOGINT DEMO\n");
-        logint_initialize();
+        debug_log(ctx, "LOGINT DEMO\n");
     } else if (flag == flag_logint_err) {
-        debug_log("LOGINT %%ERR DEMO\n");
-        logint_initialize();
+        debug_log(ctx, "LOGINT %%ERR DEMO\n");
     } else {
-        debug_log("FACTORIZATION DEMO\n");
+        debug_log(ctx, "FACTORIZATION DEMO\n");
     }
 
-    // Set initial seeds
-    get_random_seeds(&seed1, &seed2);
+    // The recursive demo builds every tree as one batch: the numbers in argv,
+    // then those of the batch file, then those a resumed checkpoint left
+    // unfinished
+    if (flag == flag_recursive) {
+        batch input;
+        init_batch(&input);
+        for (int ii = 1; ii < argc; ii++) {
+            if (argv[ii] != NULL) batch_add(&input, argv[ii]);
+        }
+        if (batch_path != NULL && !batch_read(&input, batch_path)) {
+            fprintf(stderr, "ERROR: could not read %s\n", batch_path);
+            exit(1);
+        }
+        int root_count;
+        char** roots = solsys_checkpoint_roots(ctx, &root_count);
+        for (int ii = 0; ii < root_count; ii++) batch_add(&input, roots[ii]);
+        batch_demo(ctx, &input, format);
+        free_batch(&input);
+        for (int ii = 0; ii < root_count; ii++) free(roots[ii]);
+        free(roots);
+    }
 
-    // Run recursive or simple demo on each number
-    char* inp = malloc(sizeof(char) * 100);
-    for (int ii = 1; ii < argc; ii++) {
+    // Run simple demo on each number
+    for (int ii = 1; ii < argc && flag != flag_recursive; ii++) {
         if (argv[ii] == NULL) continue;
-        strcpy(inp, argv[ii]);
-        if (flag == flag_recursive) {
-            recursive_demo(inp);
-        } else if (flag == flag_primecount) {
-            primecount_demo(inp);
+        if (flag == flag_primecount) {
+            primecount_demo(argv[ii]);
         } else if (flag == flag_logint) {
-            logint_demo(inp);
+            logint_demo(ctx, argv[ii]);
         } else if (flag == flag_logint_err) {
-            logint_err_demo(inp);
+            logint_err_demo(ctx, argv[ii]);
         } else {
-            factorization_demo(inp);
+            factorization_demo(ctx, argv[ii]);
         }
     }
-    free(inp);
-
-    // Teardown demo type
-    if (flag == flag_recursive) {
-        logint_free();
-    } else if (flag == flag_logint_err) {
-        logint_free();
-    } else if (flag == flag_logint_err) {
-        logint_free();
-    }
 
-    mpz_clear(factorization_threshold);
-    mpz_clear(logint_threshold);
+    if (ctx->stats) solsys_stats_write(ctx, NULL, stderr);
+    solsys_destroy(ctx);
+    sieve_free();
 }
 
 // Simple checker for string equality
@@ -121,311 +272,77 @@ void print_help (char* progname) {
     fprintf(stderr, " -f : run factorization demo\n");
     fprintf(stderr, " -p : run primecount demo\n");
     fprintf(stderr, " -l : run logint demo\n");
+    fprintf(stderr, " -j <n> : factor with n worker threads <default 1>\n");
+    fprintf(stderr, " --logint-threshold <x> : approximate pi(x) with li(x) from x on <default 1e13>\n");
+    fprintf(stderr, " --exact-limit <x> : past the li threshold, still count pi exactly below x\n");
+    fprintf(stderr, " --exact-budget-ms <ms> : ...when primecount should finish within ms <default 1000>\n");
+    fprintf(stderr, " --primecount-threads <n> : threads for primecount's own pool\n");
+    fprintf(stderr, " --deadline-ms <ms> : stop factoring a tree after ms, marking what is left pending\n");
+    fprintf(stderr, " --schedule <policy> : expand composites fifo, smallest first or breadth first <default smallest>\n");
+    fprintf(stderr, " --checkpoint <file> : save unfinished trees to file as they are built\n");
+    fprintf(stderr, " --checkpoint-interval-ms <ms> : ...every ms, and when each request ends <default 10000>\n");
+    fprintf(stderr, " --resume <file> : finish the trees of a checkpoint, saving back to it\n");
+    fprintf(stderr, " --savefile-dir <dir> : directory for msieve's savefiles <default $TMPDIR or /tmp>\n");
+    fprintf(stderr, " --memory-savefile-digits <n> : keep msieve's relations in memory up to n digits <default 80>\n");
+    fprintf(stderr, " --stats : print what the run spent its time on to stderr, as one line of JSON\n");
+    fprintf(stderr, " --trace <prefix> : write a Chrome trace of each request's nodes to prefix.<n>.json\n");
+    fprintf(stderr, " -c <file> : reuse factorizations and pi values stored in file\n");
+    fprintf(stderr, " --pi-table <file> : map a pi table from file, building it if missing\n");
+    fprintf(stderr, " --pi-table-bound <n> : answer pi(x) for x <= n from a table <default 2^24>\n");
+    fprintf(stderr, " --shape : print only the tree's shape, as clean.jq does\n");
+    fprintf(stderr, " --shape-key : print the shape as a canonical string, e.g. 1(01(1))\n");
+    fprintf(stderr, " --dag : print each distinct composite once, referenced by id\n");
+    fprintf(stderr, " --compact : print JSON without whitespace\n");
+    fprintf(stderr, " --range <a> <b> : print the tree of every n from a to b, sieving them together\n");
+    fprintf(stderr, " -b <file> : also build the trees of the numbers in file, one per line (- for stdin)\n");
+    fprintf(stderr, " -s : serve numbers read from stdin, one per line, until EOF\n");
     fprintf(stderr, " -d : print debug info\n");
     fprintf(stderr, " -h : show help\n");
 }
 
-void debug_log (char* format, ...) {
-    if (G_DEBUG == 0) return;
-    va_list args;
-    va_start(args, format);
-    vfprintf(stderr, format, args);
-    va_end(args);
-}
-
 /*--------------------------------------------------------------------*/
-// WORKING WITH COMPOSITES AND FACTORS (FREE AND PRINT)
-
-// Free composites with factors recursively
-// Potential stack overflow, but such a deep tree / a cyclical composite-factor
-// graph should never exist in the wild
-void free_composite (composite* composite, int freenumber) {
-    if (composite == NULL) return;
-    factor* factor = composite->factors;
-
-    struct factor* next_factor;
-    while (factor != NULL) {
-        next_factor = factor->next;
-        free_factor(factor);
-        factor = next_factor;
-    }
-
-    // Only free the number if told to - this allows us to not the collect the
-    // head of a composite tree, aka the "input"
-    if (freenumber) mpz_clear(composite->value);
-    free(composite);
-}
-
-// Frees factors with composites recursively
-void free_factor (factor* factor) {
-    if (factor == NULL) return;
-    free_composite(factor->power, 1);
-    free_composite(factor->spacer, 1);
-    mpz_clear(factor->base);
-    mpz_clear(factor->pi);
-    free(factor);
-}
-
-// Turns composite / factor trees into JSON
-void indent (FILE* out, int depth) {
-    if (depth == 0) return;
-    fprintf(out, "%*c", depth * 2, ' ');
-}
-
-void to_json (FILE* out, composite* composite) {
-    to_json_composite(out, composite, 0);
-    fprintf(out, "\n");
-}
-
-void to_json_composite (FILE* out, composite* composite, int depth) {
-    if (composite == NULL) {
-        fprintf(out, "null");
-    } else {
-        fprintf(out, "{\n");
+// SIGNALS
 
-        indent(out, depth+1);
-        gmp_fprintf(out, "\"value\": \"%Zd\",\n", composite->value);
+volatile sig_atomic_t g_interrupted = 0;
 
-        factor* f = composite->factors;
-        indent(out, depth+1);
-        fprintf(out, "\"factors\": [");
-        if (f == NULL) {
-            fprintf(out, "]\n");
-        } else {
-            int first = 1;
-
-            while (f != NULL) {
-                if (!first) {
-                    fprintf(out, ",");
-                } else {
-                    first = 0;
-                }
-
-                fprintf(out, "\n");
-                indent(out, depth+2);
-                to_json_factor(out, f, depth+2);
-                f = f->next;
-            }
-
-            fprintf(out, "\n");
-            indent(out, depth+1);
-            fprintf(out, "]\n");
-        }
+// SIGINT and SIGTERM stop any msieve run that is sieving, failing its
+// request, which the demos then end quietly; with none to stop, the
+// process ends at once
+void handle_signal (int sig) {
+    (void) sig;
+    static const char message[] = "\nreceived signal; shutting down\n";
+    write(STDERR_FILENO, message, sizeof(message) - 1);
 
-        indent(out, depth);
-        fprintf(out, "}");
-    }
+    g_interrupted = 1;
+    if (solsys_stop_sieving() == 0) _exit(0);
 }
 
-void to_json_factor (FILE* out, factor* factor, int depth) {
-    if (factor == NULL) {
-        fprintf(out, "null");
-    } else {
-        fprintf(out, "{\n");
-
-        indent(out, depth+1);
-        gmp_fprintf(out, "\"base\": \"%Zd\",\n", factor->base);
-        indent(out, depth+1);
-        fprintf(out, "\"power\": ");
-        to_json_composite(out, factor->power, depth+1);
-        fprintf(out, ",\n");
-        indent(out, depth+1);
-        gmp_fprintf(out, "\"pi\": \"%Zd\",\n", factor->pi);
-        indent(out, depth+1);
-        fprintf(out, "\"spacer\": ");
-        to_json_composite(out, factor->spacer, depth+1);
-        fprintf(out, "\n");
-
-        indent(out, depth);
-        fprintf(out, "}");
+void install_signal_handlers () {
+    if (signal(SIGINT, handle_signal) == SIG_ERR) {
+        fprintf(stderr, "could not install handler on SIGINT\n");
     }
-}
-
-/*--------------------------------------------------------------------*/
-// WORKING WITH WORKLISTS (FREE AND APPEND)
-
-worklist* free_worklist_to_next (worklist* wl) {
-    if (wl == NULL) return NULL;
-    worklist* next = wl->next;
-    free(wl->todo);
-    free(wl);
-    return next;
-}
-
-composite* schedule_factorization (worklist** wl, mpz_t number) {
-    composite* output = malloc(sizeof(composite));
-    mpz_init(output->value);
-    mpz_set(output->value, number);
-    output->factors = NULL;
-
-    // If the composite to factorize is below the threshold, don't schedule a factorization.
-    if (mpz_cmp(output->value, factorization_threshold) <= 0) return output;
-
-    // Otherwise, schedule a factorization
-    worklist* node = malloc(sizeof(worklist));
-    node->todo = mpz_get_str(NULL, 0, number);
-    node->output = output;
-
-    node->next = NULL;
-    if (*wl != NULL) {
-        node->next = (*wl)->next;
-        (*wl)->next = node;
-    } else {
-        (*wl) = node;
+    if (signal(SIGTERM, handle_signal) == SIG_ERR) {
+        fprintf(stderr, "could not install handler on SIGTERM\n");
     }
-
-    return output;
-}
-
-/*--------------------------------------------------------------------*/
-// UTILS FOR SETTING UP AN MSIEVE OBJ
-
-msieve_obj *g_curr_factorization = NULL;
-
-void handle_signal(int sig) {
-
-	msieve_obj *obj = g_curr_factorization;
-
-	fprintf(stderr, "\nreceived signal %d; shutting down\n", sig);
-	
-	if (obj && (obj->flags & MSIEVE_FLAG_SIEVING_IN_PROGRESS))
-		obj->flags |= MSIEVE_FLAG_STOP_SIEVING;
-	else
-		_exit(0);
-}
-
-void get_random_seeds(uint32 *seed1, uint32 *seed2) {
-
-	uint32 tmp_seed1, tmp_seed2;
-
-	/* In a multithreaded program, every msieve object
-	   should have two unique, non-correlated seeds
-	   chosen for it */
-
-#if !defined(WIN32) && !defined(_WIN64)
-
-	FILE *rand_device = fopen("/dev/urandom", "r");
-
-	if (rand_device != NULL) {
-
-		/* Yay! Cryptographic-quality nondeterministic randomness! */
-
-		fread(&tmp_seed1, sizeof(uint32), (size_t)1, rand_device);
-		fread(&tmp_seed2, sizeof(uint32), (size_t)1, rand_device);
-		fclose(rand_device);
-	}
-	else
-
-#endif
-	{
-		/* <Shrug> For everyone else, sample the current time,
-		   the high-res timer (hopefully not correlated to the
-		   current time), and the process ID. Multithreaded
-		   applications should fold in the thread ID too */
-
-		uint64 high_res_time = read_clock();
-		tmp_seed1 = ((uint32)(high_res_time >> 32) ^
-			     (uint32)time(NULL)) * 
-			    (uint32)getpid();
-		tmp_seed2 = (uint32)high_res_time;
-	}
-
-	/* The final seeds are the result of a multiplicative
-	   hash of the initial seeds */
-
-	(*seed1) = tmp_seed1 * ((uint32)40499 * 65543);
-	(*seed2) = tmp_seed2 * ((uint32)40499 * 65543);
-}
-
-/*--------------------------------------------------------------------*/
-
-msieve_obj * run_default_msieve (char * input) {
-    msieve_obj* o = make_default_msieve_obj();
-
-    if (o == NULL) {
-        fprintf(stderr, "factoring initialization failed for %s\n", input);
-        return NULL;
-    }
-
-    o->input = input;
-    o->seed1 = seed1;
-    o->seed2 = seed2;
-    msieve_run(o);
-    seed1 = o->seed1;
-    seed2 = o->seed2;
-
-    if (!(o->flags & MSIEVE_FLAG_FACTORIZATION_DONE)) {
-        fprintf(stderr, "\ncurrent factorization '%s' was interrupted\n", input);
-        exit(0);
-    }
-
-    return o;
-}
-
-msieve_obj * make_default_msieve_obj() {
-
-	char *savefile_name = "/tmp/msieve.dat";
-	char *logfile_name = NULL;
-	char *infile_name = "worktodo.ini";
-	char *nfs_fbfile_name = NULL;
-	uint32 flags;
-	int32 deadline = 0;
-	uint32 max_relations = 0;
-	enum cpu_type cpu;
-	uint32 cache_size1; 
-	uint32 cache_size2; 
-	uint32 num_threads = 0;
-	uint32 which_gpu = 0;
-	const char *nfs_args = NULL;
-
-	flags = MSIEVE_FLAG_USE_LOGFILE;
-    flags &= ~(MSIEVE_FLAG_USE_LOGFILE | MSIEVE_FLAG_LOG_TO_STDOUT);
-
-	get_cache_sizes(&cache_size1, &cache_size2);
-	cpu = get_cpu_type();
-
-	if (signal(SIGINT, handle_signal) == SIG_ERR) {
-	        fprintf(stderr, "could not install handler on SIGINT\n");
-	        return NULL;
-	}
-	if (signal(SIGTERM, handle_signal) == SIG_ERR) {
-	        fprintf(stderr, "could not install handler on SIGTERM\n");
-	        return NULL;
-	}     
-#ifdef HAVE_MPI
-	{
-		int32 level;
-		if ((i = MPI_Init_thread(&argc, &argv,
-				MPI_THREAD_FUNNELED, &level)) != MPI_SUCCESS) {
-			fprintf(stderr, "error %d initializing MPI, aborting\n", i);
-			MPI_Abort(MPI_COMM_WORLD, i);
-		}
-	}
-#endif
-
-    msieve_obj* o = msieve_obj_new(NULL, flags,
-			    savefile_name, logfile_name,
-			    nfs_fbfile_name,
-			    0, 0, max_relations,
-			    cpu,
-			    cache_size1, cache_size2,
-			    num_threads, which_gpu, 
-			    nfs_args);
-
-    g_curr_factorization = o;
-    return o;
 }
 
 /*--------------------------------------------------------------------*/
 
 // SIMPLE DEMO, RUNS FACTORIZATION ON EACH ARGV
-int factorization_demo(char* number) {
+int factorization_demo(solsys_ctx* ctx, char* number) {
 
 	msieve_factor *factor;
 
-    msieve_obj* o = run_default_msieve(number);
+    worker w;
+    init_worker(&w, 0, ctx, NULL);
+    register_workers(&w, 1);
+
+    msieve_obj* o = run_default_msieve(&w, number);
+    unregister_workers(&w, 1);
+    free_worker(&w);
+    if (o == NULL && g_interrupted) exit(0);
     if (o == NULL) {
-        fprintf(stderr, "Demo aborting due to failed factorization.");
+        fprintf(stderr, "Demo aborting due to failed factorization.\n");
         exit(1);
     }
 
@@ -457,194 +374,123 @@ int factorization_demo(char* number) {
 	return 0;
 }
 
-int recursive_demo (char* number) {
-    composite* tree = factor_composite(number);
-    //print_composite(tree);
-    to_json(stdout, tree);
-    free_composite(tree, 1);
+/*--------------------------------------------------------------------*/
+// BATCHES
 
-    return 0;
+void init_batch (batch* b) {
+    b->numbers = NULL;
+    b->count = 0;
+    b->capacity = 0;
 }
 
-// TODO: Massive function - refactor and split
-composite* factor_composite (char* number) {
-	uint32 seed1, seed2;
-	get_random_seeds(&seed1, &seed2);
-
-    mpz_t n;
-    mpz_init(n);
-    mpz_set_str(n, number, 0);
-    worklist* curr = NULL;
-    composite* full_factor_tree = schedule_factorization(&curr, n);
-    mpz_clear(n);
-
-    while (curr != NULL && curr->todo != NULL) {
-        debug_log("Factoring possible composite: %s\n", curr->todo);
-        msieve_obj* o = run_default_msieve(curr->todo);
-
-        if (o == NULL) {
-            fprintf(stderr, "Demo aborting due to failed factorization.");
-            exit(1);
-        }
-
-        msieve_factor* msieve_factor = o->factors;
-        mpz_t parsed_factor;
-        factor* factor_group = NULL;
-        int power = 0;
-        while (msieve_factor != NULL) {
-            mpz_init(parsed_factor);
-            mpz_set_str(parsed_factor, msieve_factor->number, 0);
-
-            if (factor_group != NULL) {
-                debug_log("Comparing: %s %s %d\n", parsed_factor, factor_group->base, msieve_factor_eq_factor_group(factor_group, parsed_factor));
-            }
-
-            if (msieve_factor_eq_factor_group(factor_group, parsed_factor)) {
-                power++;
-            } else {
-                // Schedule a power to be factorized if necessary
-                schedule_power(curr, factor_group, power);
-                // Schedule a spacer if necessary
-                schedule_spacer(curr, factor_group);
-
-                // Create a new factor_group
-                factor_group = initialize_factor_group(curr->output, factor_group, msieve_factor, parsed_factor);
-
-                power = 1;
-            }
-
-            msieve_factor = msieve_factor->next;
-            mpz_clear(parsed_factor);
-        }
-
-        // Schedule a power to be factorized if necessary
-        schedule_power(curr, factor_group, power);
-        // Schedule a spacer if necessary
-        schedule_spacer(curr, factor_group);
-
-        msieve_obj_free(o);
-
-        //curr = curr->next;
-        curr = free_worklist_to_next(curr);
-    }
-
-    return full_factor_tree;
+void free_batch (batch* b) {
+    for (int ii = 0; ii < b->count; ii++) free(b->numbers[ii]);
+    free(b->numbers);
 }
 
-int msieve_factor_eq_factor_group (factor* factor_group, mpz_t parsed_factor) {
-    return factor_group != NULL && mpz_cmp(factor_group->base, parsed_factor) == 0;
+void batch_add (batch* b, char* number) {
+    if (b->count == b->capacity) {
+        b->capacity = b->capacity ? 2 * b->capacity : 64;
+        b->numbers = realloc(b->numbers, sizeof(char*) * b->capacity);
+    }
+    b->numbers[b->count++] = strdup(number);
 }
 
-factor* initialize_factor_group (composite* parent, factor* previous_group, msieve_factor* source, mpz_t parsed) {
-    factor* new_group = malloc(sizeof(factor));
-
-    // Link to previous group, or to parent if no previous group exists
-    if (previous_group == NULL) {
-        parent->factors = new_group;
-        new_group->prev = NULL;
-    } else {
-        previous_group->next = new_group;
-        new_group->prev = previous_group;
+// Adds each non-blank line of path, or of stdin for "-", however long
+int batch_read (batch* b, char* path) {
+    FILE* in = streq(path, "-") ? stdin : fopen(path, "r");
+    if (in == NULL) return 0;
+
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &capacity, in)) != -1) {
+        while (length > 0 && isspace((unsigned char) line[length-1])) {
+            line[--length] = '\0';
+        }
+        char* number = skip_space(line);
+        if (*number != '\0') batch_add(b, number);
     }
+    free(line);
 
-    // Set next as NULL, copy source to base
-    new_group->next = NULL;
-    new_group->factor_type = source->factor_type;
-    mpz_init(new_group->base);
-    mpz_set(new_group->base, parsed);
-
-    // Calculate pi for the new_group's base value
-    pix_using_threshold(new_group->base, new_group->pi);
-
-    return new_group;
+    if (in != stdin) fclose(in);
+    return 1;
 }
 
-void pix_using_threshold (mpz_t x, mpz_t result) {
-    if (mpz_cmp(x, logint_threshold) < 0) {
-        primecount_gmp(x, result);
-    } else {
-        logint_gmp(x, result);
+// Factors the whole batch together, then prints its trees in input order.
+// Repeated numbers share one tree, and so does any sub-composite common to
+// several numbers, so each is only factored once. Numbers are read as
+// mpz_set_str reads them in base 0, so 0x and 0 prefixes work as ever; one
+// that cannot be read is reported on stderr and skipped.
+int batch_demo (solsys_ctx* ctx, batch* b, enum output_format format) {
+    const char** numbers = malloc(sizeof(char*) * (b->count + 1));
+    composite** trees = malloc(sizeof(composite*) * (b->count + 1));
+    int count = 0;
+    mpz_t n;
+    mpz_init(n);
+    for (int ii = 0; ii < b->count; ii++) {
+        if (mpz_set_str(n, b->numbers[ii], 0) == 0 && mpz_sgn(n) >= 0) {
+            numbers[count++] = b->numbers[ii];
+        } else {
+            fprintf(stderr, "ERROR: %s is not a non-negative integer\n", b->numbers[ii]);
+        }
     }
-}
-
-void primecount_gmp (mpz_t x, mpz_t result) {
-    char* input = mpz_get_str(NULL, 10, x);
-    char* pix_str = malloc(sizeof(char) * 32);
-    primecount_pi_str(input, pix_str, 32);
-
-    mpz_init(result);
-    mpz_set_str(result, pix_str, 0);
-
-    free(input);
-    free(pix_str);
-}
+    mpz_clear(n);
+    debug_log(ctx, "Batch of %d numbers\n", count);
 
-void logint_gmp (mpz_t x, mpz_t result) {
-    char* input = mpz_get_str(NULL, 10, x);
-    char* pix_str = logint(input);
+    if (!solsys_factor_batch(ctx, numbers, count, trees)) {
+        if (g_interrupted) exit(0);
+        fprintf(stderr, "Demo aborting due to failed factorization.\n");
+        exit(1);
+    }
 
-    mpz_init(result);
-    mpz_set_str(result, pix_str, 0);
+    for (int ii = 0; ii < count; ii++) print_tree(ctx, trees[ii], format);
 
-    free(input);
-    free(pix_str);
+    free(numbers);
+    free(trees);
+    return 0;
 }
 
-void schedule_spacer (worklist* curr, factor* factor_group) {
-    if (factor_group != NULL) {
-        mpz_t delta;
-        mpz_init(delta);
-        mpz_set(delta, factor_group->pi);
-
-        if (factor_group->prev != NULL) {
-            mpz_sub(delta, delta, factor_group->prev->pi);
-        }
-
-        mpz_sub_ui(delta, delta, 1);
-        if (mpz_sgn(delta) > 0) {
-            factor_group->spacer = schedule_factorization(&curr, delta);
-        } else {
-            factor_group->spacer = NULL;
-        }
-
-        mpz_clear(delta);
+void print_tree (solsys_ctx* ctx, composite* tree, enum output_format format) {
+    double start = solsys_now();
+    if (format == output_shape) {
+        to_shape(stdout, tree, ctx->compact);
+    } else if (format == output_shape_key) {
+        to_shape_key(stdout, tree);
+    } else if (format == output_dag) {
+        to_dag(stdout, tree, ctx->compact);
+    } else {
+        to_json(stdout, tree, ctx->compact);
     }
+    solsys_timer_record(ctx, timer_json, 1, start);
 }
 
-void schedule_power (worklist* curr, factor* factor_group, int power) {
-    // If the last power group occured more than once, schedule a sub-factorization
-    if (factor_group != NULL) {
-        debug_log("Found factors group: %s ^ %d\n", factor_group->base, power);
-
-        mpz_t p;
-        mpz_init(p);
-        mpz_set_si(p, power);
-        composite* composite = schedule_factorization(&curr, p);
-        mpz_clear(p);
-        factor_group->power = composite;
-    }
+// Prints each tree of --range as soon as it is built
+void print_range_tree (solsys_ctx* ctx, composite* tree, void* format) {
+    print_tree(ctx, tree, *(enum output_format*) format);
 }
 
-// Primecount demo
+// Primecount demo, through primecount's 128-bit backend
 int primecount_demo (char* number) {
-    int64_t input;
-    sscanf(number, "%ld", &input);
-
-    int64_t result = primecount_pi(input);
-    printf("%ld\n", result);
+    char result[64];
+    if (primecount_pi_str(number, result, sizeof(result)) <= 0) {
+        fprintf(stderr, "ERROR: primecount cannot count %s\n", number);
+        return 1;
+    }
+    printf("%s\n", result);
     return 0;
 }
 
 // Logarithmic integral demo
-int logint_demo (char* number) {
-    char* result = logint(number);
+int logint_demo (solsys_ctx* ctx, char* number) {
+    char* result = logint_engine_str(ctx->logint, number);
     printf("%s\n", result);
     free(result);
     return 0;
 }
 
 // Primecount / Logint demo
-int logint_err_demo (char* s_x) {
+int logint_err_demo (solsys_ctx* ctx, char* s_x) {
 
     // Parse string number to int64_t
     int64_t i_x;
@@ -655,7 +501,7 @@ int logint_err_demo (char* s_x) {
 
     // Calculate li(x)
     int64_t lix;
-    char* s_lix = logint(s_x);
+    char* s_lix = logint_engine_str(ctx->logint, s_x);
     sscanf(s_lix, "%ld", &lix);
     free(s_lix);
 
@@ -674,3 +520,203 @@ int logint_err_demo (char* s_x) {
 
     return 0;
 }
+
+/*--------------------------------------------------------------------*/
+// SERVE MODE
+
+// Answers requests from stdin until EOF, writing exactly one line of JSON to
+// stdout for each, and with --stats, one line of its stats to stderr. A
+// request is either a bare number or an object such as
+//   {"x": "360", "mode": "logint"}
+// where mode is recursive (the default), dag, shape, shape-key, primecount
+// or logint. Failures are answered with {"error": "..."} so that replies stay
+// in step with requests.
+int serve (solsys_ctx* ctx) {
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+
+    while ((length = getline(&line, &capacity, stdin)) != -1) {
+        while (length > 0 && isspace((unsigned char) line[length-1])) {
+            line[--length] = '\0';
+        }
+        char* request = skip_space(line);
+        if (*request == '\0') continue;
+
+        serve_request(ctx, request);
+        fflush(stdout);
+        if (g_interrupted) break;
+    }
+
+    free(line);
+    return 0;
+}
+
+void serve_request (solsys_ctx* ctx, char* request) {
+    char* number = NULL;
+    char* mode = NULL;
+    solsys_stats before;
+    if (ctx->stats) solsys_stats_snapshot(ctx, &before);
+
+    if (*request == '{') {
+        if (!parse_request(request, &number, &mode)) {
+            serve_error("malformed request");
+        } else if (number == NULL) {
+            serve_error("request has no x");
+        } else {
+            serve_number(ctx, number, mode == NULL ? "recursive" : mode);
+        }
+        free(number);
+        free(mode);
+    } else {
+        serve_number(ctx, request, "recursive");
+    }
+
+    if (ctx->stats) solsys_stats_write(ctx, &before, stderr);
+}
+
+void serve_number (solsys_ctx* ctx, char* number, char* mode) {
+    enum output_format format;
+    if (!is_decimal(number)) {
+        serve_error("x is not a non-negative decimal integer");
+    } else if (parse_output_format(mode, &format)) {
+        composite* tree = solsys_factor_tree(ctx, number);
+        if (tree == NULL) {
+            serve_error("factorization failed");
+            return;
+        }
+        serve_tree(ctx, tree, format);
+    } else if (streq(mode, "primecount")) {
+        char result[64];
+        if (primecount_pi_str(number, result, sizeof(result)) <= 0) {
+            serve_error("x is too large for primecount");
+            return;
+        }
+        printf("\"%s\"\n", result);
+    } else if (streq(mode, "logint")) {
+        char* result = logint_engine_str(ctx->logint, number);
+        printf("\"%s\"\n", result);
+        free(result);
+    } else {
+        serve_error("unknown mode");
+    }
+}
+
+// The tree modes of a request, as output formats
+int parse_output_format (char* mode, enum output_format* format) {
+    if (streq(mode, "recursive")) {
+        *format = output_tree;
+    } else if (streq(mode, "dag")) {
+        *format = output_dag;
+    } else if (streq(mode, "shape")) {
+        *format = output_shape;
+    } else if (streq(mode, "shape-key")) {
+        *format = output_shape_key;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// Like print_tree, but always compact, and with a shape key written as a JSON
+// string so it needs quoting on its line
+void serve_tree (solsys_ctx* ctx, composite* tree, enum output_format format) {
+    double start = solsys_now();
+    if (format == output_shape_key) {
+        json_writer w;
+        json_writer_init(&w, stdout, 1);
+        json_put(&w, "\"", 1);
+        json_write_shape(&w, tree, 1);
+        json_put(&w, "\"\n", 2);
+        json_writer_free(&w);
+    } else if (format == output_shape) {
+        to_shape(stdout, tree, 1);
+    } else if (format == output_dag) {
+        to_dag(stdout, tree, 1);
+    } else {
+        to_json(stdout, tree, 1);
+    }
+    solsys_timer_record(ctx, timer_json, 1, start);
+}
+
+void serve_error (char* message) {
+    printf("{\"error\":\"%s\"}\n", message);
+}
+
+// Reads the flat object in text, copying out the values of x and mode. Values
+// may be strings without escapes or bare scalars, and other keys are ignored.
+// Returns 0 if text is not such an object.
+int parse_request (char* text, char** x, char** mode) {
+    char* p = skip_space(text + 1);
+    if (*p == '}') return 1;
+
+    while (1) {
+        char* key = scan_json_scalar(&p);
+        if (key == NULL) return 0;
+
+        p = skip_space(p);
+        if (*p != ':') {
+            free(key);
+            return 0;
+        }
+        p = skip_space(p + 1);
+
+        char* value = scan_json_scalar(&p);
+        if (value == NULL) {
+            free(key);
+            return 0;
+        }
+
+        char** slot = streq(key, "x") ? x : streq(key, "mode") ? mode : NULL;
+        if (slot != NULL) {
+            free(*slot);
+            *slot = value;
+        } else {
+            free(value);
+        }
+        free(key);
+
+        p = skip_space(p);
+        if (*p == '}') return 1;
+        if (*p != ',') return 0;
+        p = skip_space(p + 1);
+    }
+}
+
+// Copies the string or bare scalar at *p into a new string and moves *p past it
+char* scan_json_scalar (char** p) {
+    char* start = *p;
+    char* end;
+
+    if (*start == '"') {
+        start++;
+        end = start;
+        while (*end != '"') {
+            if (*end == '\0' || *end == '\\') return NULL;
+            end++;
+        }
+        *p = end + 1;
+    } else {
+        end = start;
+        while (*end != '\0' && *end != ',' && *end != '}' && !isspace((unsigned char) *end)) {
+            end++;
+        }
+        if (end == start) return NULL;
+        *p = end;
+    }
+
+    return strndup(start, end - start);
+}
+
+char* skip_space (char* p) {
+    while (isspace((unsigned char) *p)) p++;
+    return p;
+}
+
+int is_decimal (char* s) {
+    if (*s == '\0') return 0;
+    for (; *s != '\0'; s++) {
+        if (!isdigit((unsigned char) *s)) return 0;
+    }
+    return 1;
+}
@@ -1,74 +1,43 @@
-#include <msieve.h>
-#include <primecount.h>
-#include <li.h>
+#include "solsys.h"
+#include <ctype.h>
 
-#include <gmp.h>
+// What the recursive demo prints for each tree
+enum output_format { output_tree, output_dag, output_shape, output_shape_key };
 
-#include <signal.h>
-#include <string.h>
-
-#ifdef HAVE_MPI
-#include <mpi.h>
-#endif
-
-typedef struct composite {
-    mpz_t value;
-    struct factor* factors;
-} composite;
-
-typedef struct factor {
-    // Next and previous factor in linked list
-    struct factor* next;
-    struct factor* prev;
-
-    // Values of factor itself
-    mpz_t base;
-	enum msieve_factor_type factor_type;
-    struct composite* power;
-    mpz_t pi;
-
-    // Difference between this factor and preceding factor
-    struct composite* spacer;
-} factor;
-
-// fifo queue as worklist
-typedef struct worklist {
-    composite* output;
-    char* todo;
-    struct worklist* next;
-} worklist;
+// Numbers for the recursive demo, in input order
+typedef struct batch {
+    char** numbers;
+    int count;
+    int capacity;
+} batch;
 
 void print_help();
-void debug_log(char* format, ...);
-
-void free_composite(composite*, int freenumber);
-void free_factor(factor*);
-void to_json(FILE*, composite*);
-void to_json_composite(FILE*, composite*, int depth);
-void to_json_factor(FILE*, factor*, int depth);
-
-void free_worklist(worklist*);
-composite* schedule_factorization (worklist**, mpz_t number);
+int streq(char* a, char* b);
 
-msieve_obj *g_curr_factorization;
+extern volatile sig_atomic_t g_interrupted;
 void handle_signal(int sig);
-void get_random_seeds(uint32* seed1, uint32* seed2);
-msieve_obj * make_default_msieve_obj();
-msieve_obj * run_default_msieve();
+void install_signal_handlers();
 
-int factorization_demo(char* number);
+int factorization_demo(solsys_ctx*, char* number);
 int primecount_demo(char* number);
-int logint_demo(char* number);
-int logint_err_demo(char* number);
-int recursive_demo(char* number);
-int msieve_factor_eq_factor_group (factor* factor_group, mpz_t parsed);
-void schedule_power (worklist* curr, factor* factor_group, int power);
-void schedule_spacer (worklist* curr, factor* factor_group);
-factor* initialize_factor_group (composite* parent, factor* previous_group, msieve_factor* source, mpz_t parsed);
-composite* factor_composite (char* number);
-
-int streq(char* a, char* b);
-
-void pix_using_threshold (mpz_t x, mpz_t result);
-void primecount_gmp (mpz_t x, mpz_t result);
-void logint_gmp (mpz_t x, mpz_t result);
+int logint_demo(solsys_ctx*, char* number);
+int logint_err_demo(solsys_ctx*, char* number);
+void print_tree(solsys_ctx*, composite*, enum output_format);
+
+void init_batch(batch*);
+void free_batch(batch*);
+void batch_add(batch*, char* number);
+int batch_read(batch*, char* path);
+int batch_demo(solsys_ctx*, batch*, enum output_format);
+void print_range_tree(solsys_ctx*, composite*, void* format);
+
+int serve(solsys_ctx*);
+void serve_request(solsys_ctx*, char* request);
+void serve_number(solsys_ctx*, char* number, char* mode);
+int parse_output_format(char* mode, enum output_format*);
+void serve_tree(solsys_ctx*, composite*, enum output_format);
+void serve_error(char* message);
+int parse_request(char* text, char** x, char** mode);
+char* scan_json_scalar(char** p);
+char* skip_space(char* p);
+int is_decimal(char* s);
@@ -0,0 +1,395 @@
+#include "sieve.h"
+#include "factor64.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*--------------------------------------------------------------------*/
+// SIEVING PRIMES
+
+// Odd primes up to sieving_limit, grown on demand and shared by all threads
+// Counting holds a read lock, so the table is never reallocated under a reader
+uint32_t* sieving_primes = NULL;
+uint64_t sieving_prime_count = 0;
+uint64_t sieving_limit = 0;
+pthread_rwlock_t sieving_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+uint64_t isqrt_u64 (uint64_t n) {
+    // The root of any uint64_t fits in 32 bits, so squares below never wrap
+    uint64_t r = (uint64_t) sqrtl((long double) n);
+    if (r > UINT32_MAX) r = UINT32_MAX;
+    while (r > 0 && r * r > n) r--;
+    while (r < UINT32_MAX && (r + 1) * (r + 1) <= n) r++;
+    return r;
+}
+
+// Must hold sieving_lock for writing
+void extend_sieving_primes (uint64_t limit) {
+    if (limit <= sieving_limit) return;
+
+    // Grow geometrically so a run of increasing requests sieves rarely
+    if (limit < sieving_limit * 2) limit = sieving_limit * 2;
+    if (limit < 1024) limit = 1024;
+
+    char* composite = calloc(limit + 1, 1);
+    uint64_t count = 0;
+    for (uint64_t ii = 3; ii <= limit; ii += 2) {
+        if (composite[ii]) continue;
+        count++;
+        for (uint64_t jj = ii * ii; jj <= limit; jj += 2 * ii) composite[jj] = 1;
+    }
+
+    free(sieving_primes);
+    sieving_primes = malloc(sizeof(uint32_t) * count);
+    sieving_prime_count = 0;
+    for (uint64_t ii = 3; ii <= limit; ii += 2) {
+        if (!composite[ii]) sieving_primes[sieving_prime_count++] = ii;
+    }
+    sieving_limit = limit;
+
+    free(composite);
+}
+
+void sieve_free () {
+    pthread_rwlock_wrlock(&sieving_lock);
+    free(sieving_primes);
+    sieving_primes = NULL;
+    sieving_prime_count = 0;
+    sieving_limit = 0;
+    pthread_rwlock_unlock(&sieving_lock);
+}
+
+// Ensures the sieving primes reach limit and takes the read lock on them
+void acquire_sieving_primes (uint64_t limit) {
+    pthread_rwlock_rdlock(&sieving_lock);
+    while (sieving_limit < limit) {
+        pthread_rwlock_unlock(&sieving_lock);
+        pthread_rwlock_wrlock(&sieving_lock);
+        extend_sieving_primes(limit);
+        pthread_rwlock_unlock(&sieving_lock);
+        pthread_rwlock_rdlock(&sieving_lock);
+    }
+}
+
+void release_sieving_primes () {
+    pthread_rwlock_unlock(&sieving_lock);
+}
+
+// Marks the odd composites among the span odd numbers starting at the odd
+// seg_lo, so segment[ii] is left 0 iff seg_lo + 2 * ii is prime (or 1)
+// Must hold the read lock on sieving primes up to sqrt of the last number
+void sieve_segment (uint64_t seg_lo, uint64_t span, char* segment) {
+    uint64_t seg_hi = seg_lo + 2 * (span - 1);
+    memset(segment, 0, span);
+
+    for (uint64_t ii = 0; ii < sieving_prime_count; ii++) {
+        uint64_t p = sieving_primes[ii];
+        if (p * p > seg_hi) break;
+
+        uint64_t m = (seg_lo + p - 1) / p * p;
+        if (m < p * p) m = p * p;
+        if (m % 2 == 0) m += p;
+        for (; m <= seg_hi; m += 2 * p) segment[(m - seg_lo) / 2] = 1;
+    }
+}
+
+/*--------------------------------------------------------------------*/
+// COUNTING
+
+// Number of primes p with lo < p <= hi, i.e. pi(hi) - pi(lo)
+uint64_t count_primes_between (uint64_t lo, uint64_t hi) {
+    if (hi <= lo || hi < 2) return 0;
+
+    uint64_t count = 0;
+    uint64_t first = lo + 1;
+    if (first <= 2) {
+        count++;
+        first = 3;
+    }
+    if (first % 2 == 0) first++;
+    if (first > hi) return count;
+
+    acquire_sieving_primes(isqrt_u64(hi));
+
+    char* segment = malloc(SIEVE_SEGMENT_SIZE);
+    for (uint64_t seg_lo = first; seg_lo <= hi; seg_lo += 2 * (uint64_t) SIEVE_SEGMENT_SIZE) {
+        uint64_t span = (hi - seg_lo) / 2 + 1;
+        if (span > SIEVE_SEGMENT_SIZE) span = SIEVE_SEGMENT_SIZE;
+        sieve_segment(seg_lo, span, segment);
+
+        for (uint64_t ii = 0; ii < span; ii++) count += !segment[ii];
+    }
+    free(segment);
+
+    pthread_rwlock_unlock(&sieving_lock);
+    return count;
+}
+
+// Rough cost model: primecount takes about x^(2/3) / log(x)^2 steps, while
+// sieving the gap takes about one step per number in it. Gaps ending past
+// SIEVE_COUNT_LIMIT are never sieved, however short.
+int sieve_is_cheaper (uint64_t lo, uint64_t hi) {
+    if (hi <= lo) return 1;
+    if (hi > SIEVE_COUNT_LIMIT) return 0;
+    double x = (double) hi;
+    double logx = log(x > 2 ? x : 2);
+    double primecount_cost = pow(x, 2.0 / 3.0) / (logx * logx);
+    return (double) (hi - lo) < 16 * primecount_cost;
+}
+
+/*--------------------------------------------------------------------*/
+// FACTOR SEGMENTS
+
+// Divides every n in [lo, lo + span) by each prime up to sqrt(lo + span - 1),
+// or FACTOR_SEGMENT_SIEVE_LIMIT, as often as it goes. The segment must not
+// reach past UINT64_MAX.
+factor_segment* factor_segment_build (uint64_t lo, uint64_t span) {
+    factor_segment* f = malloc(sizeof(factor_segment));
+    f->lo = lo;
+    f->span = span;
+    f->primes = malloc(sizeof(uint32_t) * FACTOR_SEGMENT_PRIMES * span);
+    f->exponents = malloc(FACTOR_SEGMENT_PRIMES * span);
+    f->counts = calloc(span, 1);
+    f->cofactors = malloc(sizeof(uint64_t) * span);
+    f->prime_counts = malloc(sizeof(uint32_t) * span);
+    for (uint64_t ii = 0; ii < span; ii++) f->cofactors[ii] = lo + ii;
+
+    uint64_t hi = lo + (span - 1);
+    uint64_t limit = isqrt_u64(hi);
+    if (limit > FACTOR_SEGMENT_SIEVE_LIMIT) limit = FACTOR_SEGMENT_SIEVE_LIMIT;
+    f->limit = limit;
+    acquire_sieving_primes(limit);
+
+    for (uint64_t jj = 0; jj <= sieving_prime_count; jj++) {
+        // 2 is not among the sieving primes
+        uint64_t p = jj == 0 ? 2 : sieving_primes[jj - 1];
+        if (p > limit) break;
+
+        // The first multiple, and each next one, may wrap past UINT64_MAX
+        uint64_t m = lo + (p - lo % p) % p;
+        for (; m <= hi && m >= lo; m += p) {
+            uint64_t ii = m - lo;
+            uint8_t exponent = 0;
+            while (f->cofactors[ii] % p == 0) {
+                f->cofactors[ii] /= p;
+                exponent++;
+            }
+
+            int slot = ii * FACTOR_SEGMENT_PRIMES + f->counts[ii]++;
+            f->primes[slot] = p;
+            f->exponents[slot] = exponent;
+        }
+    }
+    pthread_rwlock_unlock(&sieving_lock);
+
+    // n is prime when it has no factor but itself; without a small factor,
+    // only an n past limit^2 needs testing
+    uint32_t running = 0;
+    for (uint64_t ii = 0; ii < span; ii++) {
+        uint64_t n = lo + ii;
+        int slot = ii * FACTOR_SEGMENT_PRIMES;
+        if (f->counts[ii] == 1 && f->primes[slot] == n) {
+            running++;
+        } else if (f->counts[ii] == 0 && n >= 2 && (n / limit < limit || is_prime_u64(n))) {
+            running++;
+        }
+        f->prime_counts[ii] = running;
+    }
+
+    return f;
+}
+
+// Fills factors with the prime factors of n, ascending and with multiplicity,
+// as factor_u64 does. Returns -1 if n is not in the segment.
+int factor_segment_factors (factor_segment* f, uint64_t n, uint64_t* factors) {
+    if (n < f->lo || n - f->lo >= f->span) return -1;
+    uint64_t ii = n - f->lo;
+
+    int count = 0;
+    for (int jj = 0; jj < f->counts[ii]; jj++) {
+        int slot = ii * FACTOR_SEGMENT_PRIMES + jj;
+        for (int e = 0; e < f->exponents[slot]; e++) factors[count++] = f->primes[slot];
+    }
+    uint64_t cofactor = f->cofactors[ii];
+    if (cofactor / f->limit >= f->limit) {
+        count += factor_u64(cofactor, factors + count);
+    } else if (cofactor > 1) {
+        factors[count++] = cofactor;
+    }
+
+    return count;
+}
+
+void factor_segment_free (factor_segment* f) {
+    if (f == NULL) return;
+    free(f->primes);
+    free(f->exponents);
+    free(f->counts);
+    free(f->cofactors);
+    free(f->prime_counts);
+    free(f);
+}
+
+/*--------------------------------------------------------------------*/
+// PI TABLE
+
+void pi_table_count_blocks (pi_table* t) {
+    uint64_t running = 0;
+    for (uint64_t b = 0; b < t->block_count; b++) {
+        t->blocks[b] = running;
+        for (uint64_t w = b * PI_TABLE_BLOCK_WORDS; w < (b + 1) * PI_TABLE_BLOCK_WORDS && w < t->word_count; w++) {
+            running += __builtin_popcountll(t->words[w]);
+        }
+    }
+}
+
+// Words of odd numbers and blocks of counts a table up to bound holds
+void pi_table_size (uint64_t bound, uint64_t* word_count, uint64_t* block_count) {
+    *word_count = (bound / 2 + 1) / 64 + 1;
+    *block_count = *word_count / PI_TABLE_BLOCK_WORDS + 1;
+}
+
+pi_table* pi_table_build (uint64_t bound) {
+    pi_table* t = malloc(sizeof(pi_table));
+    t->bound = bound;
+    pi_table_size(bound, &t->word_count, &t->block_count);
+    t->words = calloc(t->word_count, sizeof(uint64_t));
+    t->blocks = malloc(sizeof(uint64_t) * t->block_count);
+    t->map = NULL;
+    t->map_size = 0;
+
+    // Segments start on a word boundary, so whole bytes pack into whole words
+    acquire_sieving_primes(isqrt_u64(bound));
+    char* segment = malloc(SIEVE_SEGMENT_SIZE);
+    for (uint64_t first = 0; 2 * first + 1 <= bound; first += SIEVE_SEGMENT_SIZE) {
+        uint64_t seg_lo = 2 * first + 1;
+        uint64_t span = (bound - seg_lo) / 2 + 1;
+        if (span > SIEVE_SEGMENT_SIZE) span = SIEVE_SEGMENT_SIZE;
+        sieve_segment(seg_lo, span, segment);
+
+        for (uint64_t ii = 0; ii < span; ii++) {
+            uint64_t n = seg_lo + 2 * ii;
+            if (!segment[ii] && n > 1) {
+                uint64_t bit = first + ii;
+                t->words[bit / 64] |= (uint64_t) 1 << (bit % 64);
+            }
+        }
+    }
+    free(segment);
+    pthread_rwlock_unlock(&sieving_lock);
+
+    pi_table_count_blocks(t);
+    return t;
+}
+
+// Maps the table saved at path, returning NULL if there is none, or it is not
+// a table up to bound, so the caller builds one in its place
+pi_table* pi_table_load (const char* path, uint64_t bound) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t) st.st_size < sizeof(pi_table_header)) {
+        close(fd);
+        return NULL;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    // The counts in the header are only trusted once they match the bound,
+    // and the file holds every word and block they promise
+    pi_table_header* h = map;
+    uint64_t word_count, block_count;
+    pi_table_size(h->bound, &word_count, &block_count);
+    uint64_t expected = sizeof(pi_table_header) + sizeof(uint64_t) * (word_count + block_count);
+    if (memcmp(h->magic, PI_TABLE_MAGIC, 8) != 0 || h->word_count != word_count
+        || h->block_count != block_count || (uint64_t) st.st_size != expected) {
+        fprintf(stderr, "%s is not a pi table file\n", path);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    if (h->bound != bound) {
+        fprintf(stderr, "%s holds a pi table up to %" PRIu64 ", not %" PRIu64 "; rebuilding it\n", path, h->bound, bound);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    pi_table* t = malloc(sizeof(pi_table));
+    t->bound = h->bound;
+    t->word_count = h->word_count;
+    t->block_count = h->block_count;
+    t->words = (uint64_t*) (h + 1);
+    t->blocks = t->words + t->word_count;
+    t->map = map;
+    t->map_size = st.st_size;
+    return t;
+}
+
+// Writes to a temporary file first, so a concurrent loader never maps a
+// partially written table
+int pi_table_save (pi_table* t, const char* path) {
+    char* tmp = malloc(strlen(path) + 32);
+    sprintf(tmp, "%s.%d.tmp", path, (int) getpid());
+
+    FILE* out = fopen(tmp, "wb");
+    if (out == NULL) {
+        free(tmp);
+        return 0;
+    }
+
+    pi_table_header h;
+    memcpy(h.magic, PI_TABLE_MAGIC, 8);
+    h.bound = t->bound;
+    h.word_count = t->word_count;
+    h.block_count = t->block_count;
+
+    int ok = fwrite(&h, sizeof(h), 1, out) == 1
+        && fwrite(t->words, sizeof(uint64_t), t->word_count, out) == t->word_count
+        && fwrite(t->blocks, sizeof(uint64_t), t->block_count, out) == t->block_count;
+    ok = (fclose(out) == 0) && ok;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok) unlink(tmp);
+
+    free(tmp);
+    return ok;
+}
+
+// pi(x) for x <= t->bound
+uint64_t pi_table_lookup (pi_table* t, uint64_t x) {
+    if (x < 2) return 0;
+
+    // Odd numbers 1, 3, ..., up to x occupy bits [0, odd) and 2 is counted apart
+    uint64_t odd = (x + 1) / 2;
+    uint64_t word = odd / 64;
+    uint64_t block = word / PI_TABLE_BLOCK_WORDS;
+
+    uint64_t count = 1 + t->blocks[block];
+    for (uint64_t w = block * PI_TABLE_BLOCK_WORDS; w < word; w++) {
+        count += __builtin_popcountll(t->words[w]);
+    }
+    if (odd % 64 != 0) {
+        count += __builtin_popcountll(t->words[word] & (((uint64_t) 1 << (odd % 64)) - 1));
+    }
+
+    return count;
+}
+
+void pi_table_free (pi_table* t) {
+    if (t == NULL) return;
+    if (t->map != NULL) {
+        munmap(t->map, t->map_size);
+    } else {
+        free(t->words);
+        free(t->blocks);
+    }
+    free(t);
+}
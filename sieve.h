@@ -0,0 +1,88 @@
+#include <stdint.h>
+#include <pthread.h>
+
+// Segmented sieve of Eratosthenes over odd numbers, for counting primes in
+// short intervals where a full primecount run would be wasted.
+
+// Bytes per segment, one byte per odd number
+#define SIEVE_SEGMENT_SIZE (1 << 16)
+
+// Counting up to hi needs the sieving primes to sqrt(hi), found with a byte
+// per integer; past this bound (16 MB of them) counts are left to primecount
+#define SIEVE_COUNT_LIMIT ((uint64_t) 1 << 48)
+
+// Table of pi(x) for every x up to a bound: one bit per odd number, plus the
+// running prime count at the start of each block of PI_TABLE_BLOCK_WORDS words,
+// so a lookup is one stored count and at most that many popcounts
+#define PI_TABLE_MAGIC "SOLSYSPT"
+#define PI_TABLE_BLOCK_WORDS 8
+
+typedef struct pi_table_header {
+    char magic[8];
+    uint64_t bound;
+    uint64_t word_count;
+    uint64_t block_count;
+} pi_table_header;
+
+typedef struct pi_table {
+    uint64_t bound;
+    uint64_t* words;   // bit i is set if 2i + 1 is prime
+    uint64_t* blocks;  // blocks[b] is the number of set bits before word b * PI_TABLE_BLOCK_WORDS
+    uint64_t word_count;
+    uint64_t block_count;
+
+    // Set when words and blocks live in a mapping of a table file
+    void* map;
+    uint64_t map_size;
+} pi_table;
+
+// Factorizations of a run of consecutive integers, found by striking out
+// multiples of each sieving prime instead of factoring every number alone
+#define FACTOR_SEGMENT_SIZE (1 << 14)
+
+// A uint64_t has at most 15 distinct prime factors
+#define FACTOR_SEGMENT_PRIMES 15
+
+// Past this, a sieving prime hits almost no number of a segment, so larger
+// factors are left to factor_u64
+#define FACTOR_SEGMENT_SIEVE_LIMIT (1 << 20)
+
+typedef struct factor_segment {
+    uint64_t lo;
+    uint64_t span;
+    uint64_t limit;
+
+    // For lo + ii: its distinct prime factors up to limit, FACTOR_SEGMENT_PRIMES
+    // slots from ii * FACTOR_SEGMENT_PRIMES, with their exponents, and the
+    // cofactor left over. A cofactor below limit^2 is 1 or a prime.
+    uint32_t* primes;
+    uint8_t* exponents;
+    uint8_t* counts;
+    uint64_t* cofactors;
+
+    // prime_counts[ii] is the number of primes in [lo, lo + ii]
+    uint32_t* prime_counts;
+} factor_segment;
+
+// Odd primes below a limit, in ascending order, for trial division; they
+// stay valid from acquire_sieving_primes until release_sieving_primes
+extern uint32_t* sieving_primes;
+extern uint64_t sieving_prime_count;
+
+uint64_t isqrt_u64(uint64_t n);
+void acquire_sieving_primes(uint64_t limit);
+void release_sieving_primes();
+uint64_t count_primes_between(uint64_t lo, uint64_t hi);
+int sieve_is_cheaper(uint64_t lo, uint64_t hi);
+void sieve_free();
+
+factor_segment* factor_segment_build(uint64_t lo, uint64_t span);
+int factor_segment_factors(factor_segment*, uint64_t n, uint64_t* factors);
+void factor_segment_free(factor_segment*);
+
+pi_table* pi_table_build(uint64_t bound);
+void pi_table_size(uint64_t bound, uint64_t* word_count, uint64_t* block_count);
+pi_table* pi_table_load(const char* path, uint64_t bound);
+int pi_table_save(pi_table*, const char* path);
+uint64_t pi_table_lookup(pi_table*, uint64_t x);
+void pi_table_free(pi_table*);
@@ -0,0 +1,2402 @@
+// memfd_create
+#define _GNU_SOURCE
+#include "solsys.h"
+
+/*--------------------------------------------------------------------*/
+// CONTEXTS
+
+void solsys_default_options (solsys_options* options) {
+    options->debug = 0;
+    options->compact = 0;
+    options->threads = 1;
+    options->factorization_threshold = "1";
+    options->logint_threshold = "10000000000000";
+    options->cache_file = NULL;
+    options->exact_limit = NULL;
+    options->exact_budget_ms = 1000;
+    options->primecount_threads = 0;
+    options->deadline_ms = 0;
+    options->schedule = schedule_smallest;
+    options->checkpoint_path = NULL;
+    options->resume_path = NULL;
+    options->checkpoint_interval_ms = 10000;
+    options->savefile_dir = NULL;
+    options->memory_savefile_digits = 80;
+    options->stats = 0;
+    options->trace_path = NULL;
+    options->pi_table_enabled = 0;
+    options->pi_table_path = NULL;
+    options->pi_table_bound = 1 << 24;
+}
+
+solsys_ctx* solsys_create (const solsys_options* options) {
+    // Tree nodes keep their values in arenas through GMP's allocator, which
+    // has to be in place before the first mpz is allocated
+    arena_install_gmp();
+
+    solsys_ctx* ctx = malloc(sizeof(solsys_ctx));
+
+    ctx->debug = options->debug;
+    ctx->compact = options->compact;
+    ctx->threads = options->threads < 1 ? 1 : options->threads;
+    ctx->deadline_ms = options->deadline_ms;
+    ctx->schedule = options->schedule;
+    const char* savefile_dir = options->savefile_dir ? options->savefile_dir : getenv("TMPDIR");
+    ctx->savefile_dir = strdup(savefile_dir && *savefile_dir ? savefile_dir : "/tmp");
+    ctx->memory_savefile_digits = options->memory_savefile_digits;
+    mpz_init(ctx->factorization_threshold);
+    mpz_set_str(ctx->factorization_threshold, options->factorization_threshold, 0);
+    mpz_init(ctx->logint_threshold);
+    mpz_set_str(ctx->logint_threshold, options->logint_threshold, 0);
+    mpz_init(ctx->exact_limit);
+    mpz_set_str(ctx->exact_limit, options->exact_limit ? options->exact_limit : options->logint_threshold, 0);
+    ctx->exact_budget = options->exact_budget_ms / 1000.0;
+    if (options->primecount_threads > 0) primecount_set_num_threads(options->primecount_threads);
+
+    init_composite_cache(&ctx->cache);
+    pthread_mutex_init(&ctx->request_lock, NULL);
+    arena_init(&ctx->nodes);
+    pthread_mutex_init(&ctx->nodes_lock, NULL);
+    ctx->cache_file = NULL;
+    if (options->cache_file != NULL) ctx->cache_file = store_open(options->cache_file);
+
+    ctx->checkpoint = NULL;
+    ctx->checkpoint_interval_ms = options->checkpoint_interval_ms;
+    if (options->checkpoint_path != NULL || options->resume_path != NULL) {
+        ctx->checkpoint = checkpoint_create(options->checkpoint_path ? options->checkpoint_path : options->resume_path);
+        if (options->resume_path != NULL && !checkpoint_load(ctx->checkpoint, options->resume_path)) {
+            fprintf(stderr, "could not resume from %s\n", options->resume_path);
+        }
+    }
+
+    ctx->pi_table_enabled = options->pi_table_enabled;
+    ctx->pi_table_path = options->pi_table_path ? strdup(options->pi_table_path) : NULL;
+    ctx->pi_table_bound = options->pi_table_bound;
+    ctx->pi_table = NULL;
+    ctx->pi_table_ready = 0;
+    pthread_mutex_init(&ctx->pi_table_lock, NULL);
+
+    ctx->logint = logint_engine_create();
+
+    memset(ctx->pi_tiers, 0, sizeof(ctx->pi_tiers));
+    ctx->primecount_x = 0;
+    ctx->primecount_seconds = 0;
+    pthread_mutex_init(&ctx->pi_stats_lock, NULL);
+    memset(ctx->factor_stages, 0, sizeof(ctx->factor_stages));
+    pthread_mutex_init(&ctx->factor_stats_lock, NULL);
+
+    ctx->stats = options->stats;
+    ctx->trace_path = options->trace_path ? strdup(options->trace_path) : NULL;
+    ctx->created = solsys_now();
+    ctx->requests = 0;
+    ctx->expanded = 0;
+    ctx->expand_seconds = 0;
+    memset(ctx->node_sources, 0, sizeof(ctx->node_sources));
+    memset(ctx->timers, 0, sizeof(ctx->timers));
+    pthread_mutex_init(&ctx->stats_lock, NULL);
+
+    ctx->range = NULL;
+    ctx->range_pi_before = 0;
+    ctx->range_pi_known = 0;
+    pthread_rwlock_init(&ctx->range_lock, NULL);
+
+    return ctx;
+}
+
+void solsys_destroy (solsys_ctx* ctx) {
+    if (ctx == NULL) return;
+
+    debug_log(ctx, "Composite cache: %lu hits, %lu misses\n", ctx->cache.hits, ctx->cache.misses);
+    for (int ii = 0; ii < PI_TIERS; ii++) {
+        if (ctx->pi_tiers[ii].calls == 0) continue;
+        debug_log(ctx, "Pi tier %s: %lu calls in %.6f s\n", pi_tier_names[ii], ctx->pi_tiers[ii].calls, ctx->pi_tiers[ii].seconds);
+    }
+    for (int ii = 0; ii < FACTOR_STAGES; ii++) {
+        if (ctx->factor_stages[ii].calls == 0) continue;
+        debug_log(ctx, "Factor stage %s: %lu of %lu settled in %.6f s\n", factor_stage_names[ii],
+                  ctx->factor_stages[ii].settled, ctx->factor_stages[ii].calls, ctx->factor_stages[ii].seconds);
+    }
+    for (int ii = 0; ii < SOLSYS_TIMERS; ii++) {
+        if (ctx->timers[ii].calls == 0) continue;
+        debug_log(ctx, "Timer %s: %lu calls in %.6f s\n", timer_names[ii], ctx->timers[ii].calls, ctx->timers[ii].seconds);
+    }
+    pthread_mutex_destroy(&ctx->pi_stats_lock);
+    pthread_mutex_destroy(&ctx->factor_stats_lock);
+    pthread_mutex_destroy(&ctx->stats_lock);
+    free(ctx->trace_path);
+    pthread_rwlock_destroy(&ctx->range_lock);
+    free_composite_cache(&ctx->cache);
+    pthread_mutex_destroy(&ctx->request_lock);
+    arena_free(&ctx->nodes);
+    pthread_mutex_destroy(&ctx->nodes_lock);
+    store_close(ctx->cache_file);
+    checkpoint_free(ctx->checkpoint);
+    free(ctx->savefile_dir);
+
+    pi_table_free(ctx->pi_table);
+    free(ctx->pi_table_path);
+    pthread_mutex_destroy(&ctx->pi_table_lock);
+
+    logint_engine_free(ctx->logint);
+
+    mpz_clear(ctx->factorization_threshold);
+    mpz_clear(ctx->logint_threshold);
+    mpz_clear(ctx->exact_limit);
+    free(ctx);
+}
+
+// Numbers whose trees were still being built when the checkpoint the context
+// resumed from was saved, as a malloc'd array of malloc'd strings
+char** solsys_checkpoint_roots (solsys_ctx* ctx, int* count) {
+    return checkpoint_keys(ctx->checkpoint, CHECKPOINT_ROOT, count);
+}
+
+// Builds the full solsys tree for number, which lives as long as the
+// context. The number is read as mpz_set_str reads base 0 and must not be
+// negative. Returns NULL if it cannot be read, or a factorization failed or
+// was interrupted.
+composite* solsys_factor_tree (solsys_ctx* ctx, const char* number) {
+    return factor_composite(ctx, number);
+}
+
+// Builds the tree of every n in [a, b], 2 <= a <= b, handing each
+// to emit in order. The numbers are factored a segment at a time by sieving,
+// and pi of each prime among them is counted on from pi(a - 1) as the sieve
+// finds it. Each segment's trees are then built as one batch, whose nodes
+// take those factorizations and prime counts from the segment; only the
+// powers and spacers below them need factoring or counting of their own.
+void solsys_factor_range (solsys_ctx* ctx, uint64_t a, uint64_t b, solsys_range_callback emit, void* arg) {
+    // Only worth counting on if pi of the range's primes is wanted exactly
+    treeint before, pi_before;
+    treeint_set_ui(&before, a - 1);
+    treeint_set_ui(&pi_before, 0);
+    int pi_known = pix_is_exact(ctx, &before);
+    if (pi_known) {
+        arena scratch;
+        arena_init(&scratch);
+        pix_using_threshold(ctx, &before, &pi_before, &scratch);
+        arena_free(&scratch);
+    }
+
+    for (uint64_t lo = a; ; lo += FACTOR_SEGMENT_SIZE) {
+        int last = b - lo < FACTOR_SEGMENT_SIZE;
+        uint64_t span = last ? b - lo + 1 : FACTOR_SEGMENT_SIZE;
+        factor_segment* segment = factor_segment_build(lo, span);
+
+        pthread_rwlock_wrlock(&ctx->range_lock);
+        ctx->range = segment;
+        ctx->range_pi_before = pi_known ? pi_before.word : 0;
+        ctx->range_pi_known = pi_known;
+        pthread_rwlock_unlock(&ctx->range_lock);
+
+        // Word-sized numbers never reach msieve, so the batch cannot fail
+        char* digits = malloc(span * TREEINT_WORD_DIGITS);
+        const char** numbers = malloc(sizeof(char*) * span);
+        composite** trees = malloc(sizeof(composite*) * span);
+        for (uint64_t ii = 0; ii < span; ii++) {
+            char* number = digits + ii * TREEINT_WORD_DIGITS;
+            snprintf(number, TREEINT_WORD_DIGITS, "%" PRIu64, lo + ii);
+            numbers[ii] = number;
+        }
+        factor_composites(ctx, numbers, span, trees);
+
+        pthread_rwlock_wrlock(&ctx->range_lock);
+        ctx->range = NULL;
+        pthread_rwlock_unlock(&ctx->range_lock);
+
+        for (uint64_t ii = 0; ii < span; ii++) emit(ctx, trees[ii], arg);
+        free(digits);
+        free(numbers);
+        free(trees);
+
+        if (pi_known) pi_before.word += segment->prime_counts[span - 1];
+        factor_segment_free(segment);
+        if (last) break;
+    }
+}
+
+// Builds the trees of a batch of numbers together; trees[i] belongs to
+// numbers[i] and lives as long as the context like any other. Returns 0,
+// with every tree NULL, if a number cannot be read, or a factorization failed
+// or was interrupted.
+int solsys_factor_batch (solsys_ctx* ctx, const char** numbers, int count, composite** trees) {
+    return factor_composites(ctx, numbers, count, trees);
+}
+
+// Renders a tree as the same JSON the CLI prints, into a malloc'd string
+char* solsys_to_buffer (solsys_ctx* ctx, composite* tree, size_t* length) {
+    char* buf = NULL;
+    size_t size = 0;
+    FILE* out = open_memstream(&buf, &size);
+    if (out == NULL) return NULL;
+
+    double start = solsys_now();
+    to_json(out, tree, ctx->compact);
+    fclose(out);
+    solsys_timer_record(ctx, timer_json, 1, start);
+
+    if (length != NULL) *length = size;
+    return buf;
+}
+
+/*--------------------------------------------------------------------*/
+// STATS
+
+const char* pi_tier_names[PI_TIERS] = { "table", "range", "sieve", "primecount", "logint-fast", "logint" };
+const char* factor_stage_names[FACTOR_STAGES] = { "trial", "prime", "power", "p-1", "msieve" };
+const char* timer_names[SOLSYS_TIMERS] = { "schedule", "json" };
+const char* node_source_names[NODE_SOURCES] = {
+    "factor64", "range", "store", "checkpoint", "trial", "prime", "power", "p-1", "msieve"
+};
+
+// Copies the context's counters as they stand, taking each lock in turn
+void solsys_stats_snapshot (solsys_ctx* ctx, solsys_stats* stats) {
+    stats->time = solsys_now();
+
+    pthread_mutex_lock(&ctx->cache.lock);
+    stats->cache_hits = ctx->cache.hits;
+    stats->cache_misses = ctx->cache.misses;
+    pthread_mutex_unlock(&ctx->cache.lock);
+
+    pthread_mutex_lock(&ctx->stats_lock);
+    stats->expanded = ctx->expanded;
+    stats->expand_seconds = ctx->expand_seconds;
+    memcpy(stats->node_sources, ctx->node_sources, sizeof(stats->node_sources));
+    memcpy(stats->timers, ctx->timers, sizeof(stats->timers));
+    pthread_mutex_unlock(&ctx->stats_lock);
+
+    pthread_mutex_lock(&ctx->pi_stats_lock);
+    memcpy(stats->pi_tiers, ctx->pi_tiers, sizeof(stats->pi_tiers));
+    pthread_mutex_unlock(&ctx->pi_stats_lock);
+
+    pthread_mutex_lock(&ctx->factor_stats_lock);
+    memcpy(stats->factor_stages, ctx->factor_stages, sizeof(stats->factor_stages));
+    pthread_mutex_unlock(&ctx->factor_stats_lock);
+}
+
+// Writes what the context did since an earlier snapshot, or since it was
+// created, as one line of JSON:
+//   {"stats":{"seconds":..,"cache":{..},"nodes":{..},"pi":{..},"factor":{..},"timers":{..}}}
+// Node seconds add up every worker's time, so they can exceed the wall time.
+void solsys_stats_write (solsys_ctx* ctx, solsys_stats* since, FILE* out) {
+    solsys_stats now, zero;
+    solsys_stats_snapshot(ctx, &now);
+    if (since == NULL) {
+        memset(&zero, 0, sizeof(zero));
+        zero.time = ctx->created;
+        since = &zero;
+    }
+
+    fprintf(out, "{\"stats\":{\"seconds\":%.6f", now.time - since->time);
+    fprintf(out, ",\"cache\":{\"hits\":%lu,\"misses\":%lu}",
+            now.cache_hits - since->cache_hits, now.cache_misses - since->cache_misses);
+
+    fprintf(out, ",\"nodes\":{\"count\":%lu,\"seconds\":%.6f,\"sources\":{",
+            now.expanded - since->expanded, now.expand_seconds - since->expand_seconds);
+    for (int ii = 0; ii < NODE_SOURCES; ii++) {
+        fprintf(out, "%s\"%s\":%lu", ii ? "," : "", node_source_names[ii],
+                now.node_sources[ii] - since->node_sources[ii]);
+    }
+
+    fprintf(out, "}},\"pi\":{");
+    for (int ii = 0; ii < PI_TIERS; ii++) {
+        fprintf(out, "%s\"%s\":{\"calls\":%lu,\"seconds\":%.6f}", ii ? "," : "", pi_tier_names[ii],
+                now.pi_tiers[ii].calls - since->pi_tiers[ii].calls,
+                now.pi_tiers[ii].seconds - since->pi_tiers[ii].seconds);
+    }
+
+    fprintf(out, "},\"factor\":{");
+    for (int ii = 0; ii < FACTOR_STAGES; ii++) {
+        fprintf(out, "%s\"%s\":{\"calls\":%lu,\"settled\":%lu,\"seconds\":%.6f}", ii ? "," : "", factor_stage_names[ii],
+                now.factor_stages[ii].calls - since->factor_stages[ii].calls,
+                now.factor_stages[ii].settled - since->factor_stages[ii].settled,
+                now.factor_stages[ii].seconds - since->factor_stages[ii].seconds);
+    }
+
+    fprintf(out, "},\"timers\":{");
+    for (int ii = 0; ii < SOLSYS_TIMERS; ii++) {
+        fprintf(out, "%s\"%s\":{\"calls\":%lu,\"seconds\":%.6f}", ii ? "," : "", timer_names[ii],
+                now.timers[ii].calls - since->timers[ii].calls,
+                now.timers[ii].seconds - since->timers[ii].seconds);
+    }
+    fprintf(out, "}}}\n");
+}
+
+// Adds calls timed since start to a timer, returning the time they took
+double solsys_timer_record (solsys_ctx* ctx, enum solsys_timer timer, unsigned long calls, double start) {
+    double elapsed = solsys_now() - start;
+    pthread_mutex_lock(&ctx->stats_lock);
+    ctx->timers[timer].calls += calls;
+    ctx->timers[timer].seconds += elapsed;
+    pthread_mutex_unlock(&ctx->stats_lock);
+    return elapsed;
+}
+
+// Workers count their nodes without locking, and hand the totals over here
+// when the request ends
+void merge_worker_stats (worker* w) {
+    solsys_ctx* ctx = w->ctx;
+    pthread_mutex_lock(&ctx->stats_lock);
+    ctx->expanded += w->expanded;
+    ctx->expand_seconds += w->expand_seconds;
+    for (int ii = 0; ii < NODE_SOURCES; ii++) ctx->node_sources[ii] += w->node_sources[ii];
+    ctx->timers[timer_schedule].calls += w->schedule.calls;
+    ctx->timers[timer_schedule].seconds += w->schedule.seconds;
+    pthread_mutex_unlock(&ctx->stats_lock);
+}
+
+// Notes that source took part in the node being expanded; the node counts
+// under the dearest source it needed
+void node_answered (worker* w, enum node_source source) {
+    if (source > w->source) w->source = source;
+}
+
+// Appends the node just expanded to the worker's trace as a complete event,
+// timed in microseconds on the monotonic clock
+void trace_node (worker* w, worklist* item, double start, double pi_seconds) {
+    double end = solsys_now();
+    char event[256];
+    int length = snprintf(event, sizeof(event),
+        "%s{\"name\":\"factor\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+        "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"bits\":%lu,\"digits\":%lu,\"depth\":%d,\"pi_us\":%.3f}}",
+        w->trace_length ? ",\n" : "", node_source_names[w->source], (int) getpid(), w->id,
+        start * 1e6, (end - start) * 1e6, (unsigned long) treeint_bits(&item->output->value),
+        (unsigned long) strlen(item->todo), item->depth, pi_seconds * 1e6);
+    if (length < 0 || length >= (int) sizeof(event)) return;
+
+    if (w->trace_length + length > w->trace_capacity) {
+        w->trace_capacity = w->trace_capacity ? 2 * w->trace_capacity : 16384;
+        if (w->trace_capacity < w->trace_length + length) w->trace_capacity = w->trace_length + length;
+        w->trace = realloc(w->trace, w->trace_capacity);
+    }
+    memcpy(w->trace + w->trace_length, event, length);
+    w->trace_length += length;
+}
+
+// Writes every worker's trace of a request to <trace_path>.<request>.json, in
+// the Trace Event Format chrome://tracing and Perfetto read
+void write_trace (solsys_ctx* ctx, worker* workers, int count, unsigned long request) {
+    size_t length = strlen(ctx->trace_path) + 32;
+    char* path = malloc(length);
+    snprintf(path, length, "%s.%lu.json", ctx->trace_path, request);
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "could not write trace %s\n", path);
+        free(path);
+        return;
+    }
+
+    fprintf(out, "{\"traceEvents\":[\n");
+    int first = 1;
+    for (int ii = 0; ii < count; ii++) {
+        if (workers[ii].trace_length == 0) continue;
+        if (!first) fprintf(out, ",\n");
+        fwrite(workers[ii].trace, 1, workers[ii].trace_length, out);
+        first = 0;
+    }
+    fprintf(out, "\n]}\n");
+    fclose(out);
+    debug_log(ctx, "Wrote trace %s\n", path);
+    free(path);
+}
+
+/*--------------------------------------------------------------------*/
+// I/O UTILITIES
+
+void debug_log (solsys_ctx* ctx, char* format, ...) {
+    if (ctx == NULL || ctx->debug == 0) return;
+    va_list args;
+    va_start(args, format);
+    // GMP's printf, so values can be logged with %Zd
+    gmp_vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+/*--------------------------------------------------------------------*/
+// JSON OUTPUT
+
+// Turns composite / factor trees into JSON. Output is staged in the writer's
+// own buffer and values are formatted straight into it, so the only calls
+// into stdio are whole-buffer writes. The tree is walked with an explicit
+// stack, so depth is bounded by memory rather than by the C stack.
+void to_json (FILE* out, composite* tree, int compact) {
+    json_writer w;
+    json_writer_init(&w, out, compact);
+    json_write_tree(&w, tree);
+    json_put(&w, "\n", 1);
+    json_writer_free(&w);
+}
+
+void json_writer_init (json_writer* w, FILE* out, int compact) {
+    w->out = out;
+    w->length = 0;
+    w->compact = compact;
+    w->frames = w->inline_frames;
+    w->frame_capacity = JSON_INLINE_FRAMES;
+}
+
+// Writes out anything still buffered and releases a spilled stack
+void json_writer_free (json_writer* w) {
+    json_flush(w);
+    if (w->frames != w->inline_frames) free(w->frames);
+}
+
+void json_flush (json_writer* w) {
+    if (w->length > 0) fwrite(w->buf, 1, w->length, w->out);
+    w->length = 0;
+}
+
+void json_put (json_writer* w, const char* s, size_t length) {
+    if (w->length + length > JSON_BUFFER_SIZE) {
+        json_flush(w);
+        if (length > JSON_BUFFER_SIZE) {
+            fwrite(s, 1, length, w->out);
+            return;
+        }
+    }
+    memcpy(w->buf + w->length, s, length);
+    w->length += length;
+}
+
+// Writes a quoted decimal value
+void json_put_treeint (json_writer* w, treeint* value) {
+    size_t digits = treeint_max_digits(value);
+
+    json_put(w, "\"", 1);
+    if (w->length + digits > JSON_BUFFER_SIZE) json_flush(w);
+    if (digits > JSON_BUFFER_SIZE) {
+        mpz_out_str(w->out, 10, value->big);
+    } else {
+        w->length += treeint_to_str(w->buf + w->length, value);
+    }
+    json_put(w, "\"", 1);
+}
+
+// Marks a composite the request ran out of time for; its factors are empty
+void json_put_pending (json_writer* w, composite* c, int depth) {
+    if (!c->pending) return;
+    json_put(w, ",", 1);
+    json_newline(w, depth);
+    json_key(w, "pending");
+    json_put(w, "true", 4);
+}
+
+// Starts a line at the given depth; compact output has no lines
+void json_newline (json_writer* w, int depth) {
+    if (w->compact) return;
+    json_put(w, "\n", 1);
+    for (int ii = 0; ii < depth; ii++) json_put(w, "  ", 2);
+}
+
+// Writes "name": or "name":<space>, depending on the mode
+void json_key (json_writer* w, const char* name) {
+    json_put(w, "\"", 1);
+    json_put(w, name, strlen(name));
+    if (w->compact) {
+        json_put(w, "\":", 2);
+    } else {
+        json_put(w, "\": ", 3);
+    }
+}
+
+void json_push (json_writer* w, int* count, int kind, void* node, int depth) {
+    if (*count == w->frame_capacity) {
+        int capacity = w->frame_capacity * 2;
+        json_frame* frames = malloc(sizeof(json_frame) * capacity);
+        memcpy(frames, w->frames, sizeof(json_frame) * w->frame_capacity);
+        if (w->frames != w->inline_frames) free(w->frames);
+        w->frames = frames;
+        w->frame_capacity = capacity;
+    }
+
+    json_frame* frame = &w->frames[(*count)++];
+    frame->kind = kind;
+    frame->node = node;
+    frame->next = NULL;
+    frame->stage = 0;
+    frame->depth = depth;
+    frame->type = 0;
+    frame->children = 0;
+}
+
+// Each frame is a composite or factor part-way through being written; stage
+// records which of its fields come next
+void json_write_tree (json_writer* w, composite* tree) {
+    int count = 0;
+    json_push(w, &count, JSON_COMPOSITE, tree, 0);
+
+    while (count > 0) {
+        json_frame* frame = &w->frames[count - 1];
+        int depth = frame->depth;
+
+        if (frame->kind == JSON_COMPOSITE) {
+            composite* c = frame->node;
+            if (frame->stage == 0) {
+                if (c == NULL) {
+                    json_put(w, "null", 4);
+                    count--;
+                    continue;
+                }
+                json_put(w, "{", 1);
+                json_newline(w, depth+1);
+                json_key(w, "value");
+                json_put_treeint(w, &c->value);
+                json_put(w, ",", 1);
+                json_newline(w, depth+1);
+                json_key(w, "factors");
+                json_put(w, "[", 1);
+                frame->next = c->factors;
+                frame->stage = c->factors == NULL ? 2 : 1;
+                if (frame->stage == 2) {
+                    json_put(w, "]", 1);
+                    json_put_pending(w, c, depth+1);
+                }
+            } else if (frame->stage == 1) {
+                factor* f = frame->next;
+                if (f == NULL) {
+                    json_newline(w, depth+1);
+                    json_put(w, "]", 1);
+                    frame->stage = 2;
+                } else {
+                    if (f != c->factors) json_put(w, ",", 1);
+                    json_newline(w, depth+2);
+                    frame->next = f->next;
+                    json_push(w, &count, JSON_FACTOR, f, depth+2);
+                }
+            } else {
+                json_newline(w, depth);
+                json_put(w, "}", 1);
+                count--;
+            }
+        } else {
+            factor* f = frame->node;
+            if (frame->stage == 0) {
+                json_put(w, "{", 1);
+                json_newline(w, depth+1);
+                json_key(w, "base");
+                json_put_treeint(w, &f->base);
+                json_put(w, ",", 1);
+                json_newline(w, depth+1);
+                json_key(w, "power");
+                frame->stage = 1;
+                json_push(w, &count, JSON_COMPOSITE, f->power, depth+1);
+            } else if (frame->stage == 1) {
+                json_put(w, ",", 1);
+                json_newline(w, depth+1);
+                json_key(w, "pi");
+                json_put_treeint(w, &f->pi);
+                json_put(w, ",", 1);
+                json_newline(w, depth+1);
+                json_key(w, "spacer");
+                frame->stage = 2;
+                json_push(w, &count, JSON_COMPOSITE, f->spacer, depth+1);
+            } else {
+                json_newline(w, depth);
+                json_put(w, "}", 1);
+                count--;
+            }
+        }
+    }
+}
+
+// The skeleton clean.jq keeps: each composite becomes {type, children}, with
+// the spacer (type 0) then the power (type 1) of each of its factors as
+// children, and the root as type 1. No values are printed, so no mpz is ever
+// converted to decimal.
+void to_shape (FILE* out, composite* tree, int compact) {
+    json_writer w;
+    json_writer_init(&w, out, compact);
+    json_write_shape(&w, tree, 0);
+    json_put(&w, "\n", 1);
+    json_writer_free(&w);
+}
+
+// The same skeleton as a short canonical string, usable as a dedup key: each
+// node is its type, followed by its children in parentheses if it has any,
+// e.g. "1(01(1))"
+void to_shape_key (FILE* out, composite* tree) {
+    json_writer w;
+    json_writer_init(&w, out, 1);
+    json_write_shape(&w, tree, 1);
+    json_put(&w, "\n", 1);
+    json_writer_free(&w);
+}
+
+// Frames here are composites only; next and stage track which child of the
+// current factor (spacer, then power) is due
+void json_write_shape (json_writer* w, composite* tree, int canonical) {
+    int count = 0;
+    if (tree == NULL) {
+        json_put(w, "null", 4);
+        return;
+    }
+    json_push(w, &count, JSON_SHAPE, tree, 0);
+    w->frames[0].type = 1;
+
+    while (count > 0) {
+        json_frame* frame = &w->frames[count - 1];
+        int depth = frame->depth;
+        composite* c = frame->node;
+
+        if (frame->stage == 0) {
+            char type = '0' + frame->type;
+            if (canonical) {
+                json_put(w, &type, 1);
+            } else {
+                json_put(w, "{", 1);
+                json_newline(w, depth+1);
+                json_key(w, "type");
+                json_put(w, &type, 1);
+                json_put(w, ",", 1);
+                json_newline(w, depth+1);
+                json_key(w, "children");
+                json_put(w, "[", 1);
+            }
+            frame->next = c->factors;
+            frame->stage = 1;
+            continue;
+        }
+
+        // Find the next child that exists, moving through the factor list
+        composite* child = NULL;
+        int child_type = 0;
+        while (child == NULL && frame->next != NULL) {
+            if (frame->stage == 1) {
+                child = frame->next->spacer;
+                child_type = 0;
+                frame->stage = 2;
+            } else {
+                child = frame->next->power;
+                child_type = 1;
+                frame->stage = 1;
+                frame->next = frame->next->next;
+            }
+        }
+
+        if (child != NULL) {
+            if (canonical) {
+                if (frame->children == 0) json_put(w, "(", 1);
+            } else {
+                if (frame->children > 0) json_put(w, ",", 1);
+                json_newline(w, depth+2);
+            }
+            frame->children++;
+            json_push(w, &count, JSON_SHAPE, child, depth+2);
+            w->frames[count - 1].type = child_type;
+        } else {
+            if (canonical) {
+                if (frame->children > 0) json_put(w, ")", 1);
+            } else {
+                if (frame->children > 0) json_newline(w, depth+1);
+                json_put(w, "]", 1);
+                json_newline(w, depth);
+                json_put(w, "}", 1);
+            }
+            count--;
+        }
+    }
+}
+
+// Equal values share one composite (see cache_composite), so a tree is really
+// a DAG. This writes each distinct composite once, as
+//   {"root": 0, "nodes": [{"value": ..., "factors": [...]}, ...]}
+// where a factor's power and spacer are ids, i.e. indices into nodes, and the
+// output grows with the number of distinct values rather than tree size.
+void to_dag (FILE* out, composite* tree, int compact) {
+    json_writer w;
+    json_writer_init(&w, out, compact);
+
+    dag_ids ids;
+    init_dag_ids(&ids);
+    if (tree != NULL) dag_id(&ids, tree);
+
+    json_put(&w, "{", 1);
+    json_newline(&w, 1);
+    json_key(&w, "root");
+    json_put(&w, tree == NULL ? "null" : "0", tree == NULL ? 4 : 1);
+    json_put(&w, ",", 1);
+    json_newline(&w, 1);
+    json_key(&w, "nodes");
+    json_put(&w, "[", 1);
+
+    // Nodes are numbered as they are first referenced, so ids.count grows
+    // while this loop runs and every id is written exactly once
+    for (size_t ii = 0; ii < ids.count; ii++) {
+        composite* c = ids.nodes[ii];
+        if (ii > 0) json_put(&w, ",", 1);
+        json_newline(&w, 2);
+        json_put(&w, "{", 1);
+        json_newline(&w, 3);
+        json_key(&w, "value");
+        json_put_treeint(&w, &c->value);
+        json_put(&w, ",", 1);
+        json_newline(&w, 3);
+        json_key(&w, "factors");
+        json_put(&w, "[", 1);
+
+        for (factor* f = c->factors; f != NULL; f = f->next) {
+            if (f != c->factors) json_put(&w, ",", 1);
+            json_newline(&w, 4);
+            json_put(&w, "{", 1);
+            json_newline(&w, 5);
+            json_key(&w, "base");
+            json_put_treeint(&w, &f->base);
+            json_put(&w, ",", 1);
+            json_newline(&w, 5);
+            json_key(&w, "power");
+            json_put_dag_id(&w, &ids, f->power);
+            json_put(&w, ",", 1);
+            json_newline(&w, 5);
+            json_key(&w, "pi");
+            json_put_treeint(&w, &f->pi);
+            json_put(&w, ",", 1);
+            json_newline(&w, 5);
+            json_key(&w, "spacer");
+            json_put_dag_id(&w, &ids, f->spacer);
+            json_newline(&w, 4);
+            json_put(&w, "}", 1);
+        }
+
+        if (c->factors != NULL) json_newline(&w, 3);
+        json_put(&w, "]", 1);
+        json_put_pending(&w, c, 3);
+        json_newline(&w, 2);
+        json_put(&w, "}", 1);
+    }
+
+    if (ids.count > 0) json_newline(&w, 1);
+    json_put(&w, "]", 1);
+    json_newline(&w, 0);
+    json_put(&w, "}\n", 2);
+
+    free_dag_ids(&ids);
+    json_writer_free(&w);
+}
+
+void json_put_dag_id (json_writer* w, dag_ids* ids, composite* node) {
+    if (node == NULL) {
+        json_put(w, "null", 4);
+        return;
+    }
+    char digits[24];
+    int length = sprintf(digits, "%zu", dag_id(ids, node));
+    json_put(w, digits, length);
+}
+
+void init_dag_ids (dag_ids* ids) {
+    ids->capacity = 64;
+    ids->count = 0;
+    ids->slots = calloc(ids->capacity, sizeof(composite*));
+    ids->slot_ids = malloc(sizeof(size_t) * ids->capacity);
+    ids->nodes = malloc(sizeof(composite*) * ids->capacity);
+}
+
+void free_dag_ids (dag_ids* ids) {
+    free(ids->slots);
+    free(ids->slot_ids);
+    free(ids->nodes);
+}
+
+// Open addressing on the node's address; capacity is a power of two and kept
+// at least twice the count
+size_t dag_slot (dag_ids* ids, composite* node) {
+    size_t mask = ids->capacity - 1;
+    size_t slot = (size_t) (((uintptr_t) node >> 4) * 11400714819323198485UL) & mask;
+    while (ids->slots[slot] != NULL && ids->slots[slot] != node) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Returns node's id, numbering it next if it has not been seen before
+size_t dag_id (dag_ids* ids, composite* node) {
+    size_t slot = dag_slot(ids, node);
+    if (ids->slots[slot] == node) return ids->slot_ids[slot];
+
+    if (2 * (ids->count + 1) > ids->capacity) {
+        grow_dag_ids(ids);
+        slot = dag_slot(ids, node);
+    }
+
+    size_t id = ids->count++;
+    ids->slots[slot] = node;
+    ids->slot_ids[slot] = id;
+    ids->nodes[id] = node;
+    return id;
+}
+
+void grow_dag_ids (dag_ids* ids) {
+    composite** slots = ids->slots;
+    size_t* slot_ids = ids->slot_ids;
+    size_t capacity = ids->capacity;
+
+    ids->capacity *= 2;
+    ids->slots = calloc(ids->capacity, sizeof(composite*));
+    ids->slot_ids = malloc(sizeof(size_t) * ids->capacity);
+    ids->nodes = realloc(ids->nodes, sizeof(composite*) * ids->capacity);
+
+    for (size_t ii = 0; ii < capacity; ii++) {
+        if (slots[ii] == NULL) continue;
+        size_t slot = dag_slot(ids, slots[ii]);
+        ids->slots[slot] = slots[ii];
+        ids->slot_ids[slot] = slot_ids[ii];
+    }
+
+    free(slots);
+    free(slot_ids);
+}
+
+/*--------------------------------------------------------------------*/
+// COMPOSITE CACHE
+
+void init_composite_cache (composite_cache* cache) {
+    cache->bucket_count = 1024;
+    cache->buckets = calloc(cache->bucket_count, sizeof(cache_entry*));
+    cache->size = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    pthread_mutex_init(&cache->lock, NULL);
+}
+
+// Entries and their composites are in the node arena, so only the bucket
+// array is the cache's own
+void free_composite_cache (composite_cache* cache) {
+    free(cache->buckets);
+    pthread_mutex_destroy(&cache->lock);
+}
+
+void grow_composite_cache (composite_cache* cache) {
+    unsigned long bucket_count = cache->bucket_count * 2;
+    cache_entry** buckets = calloc(bucket_count, sizeof(cache_entry*));
+
+    for (unsigned long ii = 0; ii < cache->bucket_count; ii++) {
+        cache_entry* entry = cache->buckets[ii];
+        while (entry != NULL) {
+            cache_entry* next = entry->next;
+            unsigned long slot = entry->hash % bucket_count;
+            entry->next = buckets[slot];
+            buckets[slot] = entry;
+            entry = next;
+        }
+    }
+
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucket_count = bucket_count;
+}
+
+// Returns the composite for value, creating it if this is the first time the
+// value has been seen. *created tells the caller whether it is responsible for
+// scheduling the new composite's factorization.
+composite* cache_composite (composite_cache* cache, treeint* value, int* created, arena* nodes) {
+    unsigned long hash = hash_treeint(value);
+
+    pthread_mutex_lock(&cache->lock);
+    cache_entry* entry = cache->buckets[hash % cache->bucket_count];
+    while (entry != NULL) {
+        if (entry->hash == hash && treeint_cmp(&entry->node->value, value) == 0) {
+            cache->hits++;
+            pthread_mutex_unlock(&cache->lock);
+            *created = 0;
+            return entry->node;
+        }
+        entry = entry->next;
+    }
+
+    composite* output = arena_alloc(nodes, sizeof(composite));
+    treeint_copy(&output->value, value, nodes);
+    output->factors = NULL;
+    output->pending = 0;
+
+    entry = arena_alloc(nodes, sizeof(cache_entry));
+    entry->hash = hash;
+    entry->node = output;
+    entry->next = cache->buckets[hash % cache->bucket_count];
+    cache->buckets[hash % cache->bucket_count] = entry;
+    cache->size++;
+    cache->misses++;
+    if (cache->size > cache->bucket_count) grow_composite_cache(cache);
+    pthread_mutex_unlock(&cache->lock);
+
+    *created = 1;
+    return output;
+}
+
+/*--------------------------------------------------------------------*/
+// WORKING WITH WORKLISTS (FREE AND APPEND)
+
+void init_workqueue (workqueue* queue, solsys_ctx* ctx) {
+    queue->ctx = ctx;
+    queue->policy = ctx->schedule;
+    queue->heap = NULL;
+    queue->count = 0;
+    queue->capacity = 0;
+    queue->scheduled = 0;
+    queue->in_flight = 0;
+    queue->expired = 0;
+    queue->failed = 0;
+    queue->deadline = ctx->deadline_ms > 0 ? solsys_now() + ctx->deadline_ms / 1000.0 : 0;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+}
+
+// Items live in their scheduling worker's scratch arena, which is released
+// once the whole request is done
+void free_workqueue (workqueue* queue) {
+    free(queue->heap);
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->changed);
+}
+
+// Blocks until an item is available, or returns NULL once the queue is empty
+// and no worker is still expanding an item that could schedule more
+worklist* take_work (workqueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0 && queue->in_flight > 0) {
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    }
+
+    worklist* item = NULL;
+    if (queue->count > 0) {
+        item = queue->heap[0];
+        worklist* last = queue->heap[--queue->count];
+
+        // Sift the last item down from the root
+        size_t ii = 0;
+        for (;;) {
+            size_t child = 2 * ii + 1;
+            if (child >= queue->count) break;
+            if (child + 1 < queue->count && work_before(queue, queue->heap[child + 1], queue->heap[child])) child++;
+            if (!work_before(queue, queue->heap[child], last)) break;
+            queue->heap[ii] = queue->heap[child];
+            ii = child;
+        }
+        if (queue->count > 0) queue->heap[ii] = last;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return item;
+}
+
+// Whether a comes out of the queue before b; ties go in scheduling order
+int work_before (workqueue* queue, worklist* a, worklist* b) {
+    switch (queue->policy) {
+        case schedule_smallest:
+            if (a->cost != b->cost) return a->cost < b->cost;
+            if (a->depth != b->depth) return a->depth < b->depth;
+            break;
+        case schedule_breadth:
+            if (a->depth != b->depth) return a->depth < b->depth;
+            if (a->cost != b->cost) return a->cost < b->cost;
+            break;
+        case schedule_fifo:
+            break;
+    }
+    return a->sequence < b->sequence;
+}
+
+// Adds an item to the heap; the caller holds the queue's lock
+void push_work (workqueue* queue, worklist* item) {
+    if (queue->count == queue->capacity) {
+        queue->capacity = queue->capacity ? 2 * queue->capacity : 64;
+        queue->heap = realloc(queue->heap, sizeof(worklist*) * queue->capacity);
+    }
+
+    item->sequence = queue->scheduled++;
+    size_t ii = queue->count++;
+    while (ii > 0) {
+        size_t parent = (ii - 1) / 2;
+        if (!work_before(queue, item, queue->heap[parent])) break;
+        queue->heap[ii] = queue->heap[parent];
+        ii = parent;
+    }
+    queue->heap[ii] = item;
+}
+
+// Expected effort to expand a number, in bits: words fall to factor64 and
+// primes to a single test, so both rank below anything msieve has to sieve
+unsigned long estimate_cost (treeint* number) {
+    unsigned long bits = treeint_bits(number);
+    if (number->big != NULL && mpz_probab_prime_p(number->big, 1)) return 64;
+    return bits;
+}
+
+void finish_work (workqueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->in_flight--;
+    if (queue->in_flight == 0) pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+// Gives up on the request: what is still queued is left pending, and the
+// request reports failure when it ends
+void fail_work (workqueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->failed = 1;
+    queue->expired = 1;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+composite* schedule_factorization (worker* w, treeint* number) {
+    workqueue* queue = w->queue;
+
+    // Values seen before are shared with the existing (possibly still
+    // in-progress) composite rather than factorized again, unless an earlier
+    // request left it pending and this one claims it
+    int created;
+    composite* output = cache_composite(&queue->ctx->cache, number, &created, &w->nodes);
+    if (!created && !__sync_bool_compare_and_swap(&output->pending, 1, 0)) return output;
+
+    // If the composite to factorize is below the threshold, don't schedule a factorization.
+    if (treeint_cmp_mpz(&output->value, queue->ctx->factorization_threshold) <= 0) return output;
+
+    // Otherwise, schedule a factorization
+    worklist* node = arena_alloc(&w->scratch, sizeof(worklist));
+    node->todo = arena_alloc(&w->scratch, treeint_max_digits(number));
+    treeint_to_str(node->todo, number);
+    node->output = output;
+    node->cost = queue->policy == schedule_fifo ? 0 : estimate_cost(number);
+    node->depth = w->depth;
+
+    pthread_mutex_lock(&queue->lock);
+    push_work(queue, node);
+    queue->in_flight++;
+    pthread_cond_signal(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+
+    return output;
+}
+
+/*--------------------------------------------------------------------*/
+// WORKERS
+
+worker* volatile g_workers[SOLSYS_MAX_WORKERS];
+
+void init_worker (worker* w, int id, solsys_ctx* ctx, workqueue* queue) {
+    w->id = id;
+    w->slot = -1;
+    w->ctx = ctx;
+    w->queue = queue;
+    w->curr = NULL;
+    w->running = NULL;
+    w->depth = 0;
+    w->deferred = 0;
+    w->source = node_source_factor64;
+    w->expanded = 0;
+    w->expand_seconds = 0;
+    memset(w->node_sources, 0, sizeof(w->node_sources));
+    w->schedule.calls = 0;
+    w->schedule.seconds = 0;
+    w->trace = NULL;
+    w->trace_length = 0;
+    w->trace_capacity = 0;
+    arena_init(&w->nodes);
+    arena_init(&w->scratch);
+    get_random_seeds(&w->seed1, &w->seed2);
+    open_savefiles(w);
+}
+
+// Releases everything init_worker set up, for a worker used outside a
+// request; factor_composites hands its workers' nodes to the context instead
+void free_worker (worker* w) {
+    arena_free(&w->nodes);
+    arena_free(&w->scratch);
+    free(w->trace);
+    w->trace = NULL;
+    close_savefiles(w);
+}
+
+// Names the worker's savefiles: one on disk, unique to the process and the
+// request, and one in memory for small inputs where it is available
+void open_savefiles (worker* w) {
+    static unsigned long serial = 0;
+    snprintf(w->savefile_name, sizeof(w->savefile_name), "%s/msieve-%d-%lu.dat",
+             w->ctx->savefile_dir, (int) getpid(), __sync_fetch_and_add(&serial, 1));
+
+    // msieve opens its savefile by name, and reopening a memfd through /proc
+    // reaches the same memory
+    w->memory_fd = w->ctx->memory_savefile_digits > 0 ? memfd_create("msieve", MFD_CLOEXEC) : -1;
+    w->memory_savefile_name[0] = '\0';
+    if (w->memory_fd >= 0) {
+        snprintf(w->memory_savefile_name, sizeof(w->memory_savefile_name), "/proc/self/fd/%d", w->memory_fd);
+    }
+}
+
+void close_savefiles (worker* w) {
+    unlink(w->savefile_name);
+    if (w->memory_fd >= 0) close(w->memory_fd);
+    w->memory_fd = -1;
+}
+
+// The savefile a run on input uses. MPQS on an input of up to
+// memory_savefile_digits finishes in one run, so its relations need not
+// outlive the process.
+char* worker_savefile (worker* w, char* input) {
+    if (w->memory_fd >= 0 && strlen(input) <= (size_t) w->ctx->memory_savefile_digits) return w->memory_savefile_name;
+    return w->savefile_name;
+}
+
+// Claims a free slot for each worker; a worker left without one is simply not
+// interrupted by signals
+void register_workers (worker* workers, int count) {
+    for (int ii = 0; ii < count; ii++) {
+        for (int slot = 0; slot < SOLSYS_MAX_WORKERS; slot++) {
+            if (__sync_bool_compare_and_swap(&g_workers[slot], NULL, &workers[ii])) {
+                workers[ii].slot = slot;
+                break;
+            }
+        }
+    }
+}
+
+void unregister_workers (worker* workers, int count) {
+    for (int ii = 0; ii < count; ii++) {
+        if (workers[ii].slot >= 0) g_workers[workers[ii].slot] = NULL;
+        workers[ii].slot = -1;
+    }
+}
+
+void* run_worker (void* arg) {
+    worker* w = arg;
+    worklist* item;
+
+    while ((item = take_work(w->queue)) != NULL) {
+        if (w->queue->expired) {
+            item->output->pending = 1;
+        } else {
+            w->depth = item->depth + 1;
+            expand_composite(w, item);
+        }
+        finish_work(w->queue);
+    }
+
+    // mpfr keeps per-thread constant caches
+    mpfr_free_cache();
+    return NULL;
+}
+
+void start_watchdog (watchdog* dog, workqueue* queue, worker* workers, int count) {
+    solsys_ctx* ctx = queue->ctx;
+    double now = solsys_now();
+    dog->queue = queue;
+    dog->workers = workers;
+    dog->count = count;
+    dog->deadline = queue->deadline;
+    dog->interval = solsys_checkpointing(ctx) ? ctx->checkpoint_interval_ms / 1000.0 : 0;
+    dog->next_save = now + dog->interval;
+    dog->done = 0;
+
+    // The deadline is on the monotonic clock, so waits must be too
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&dog->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&dog->lock, NULL);
+
+    pthread_create(&dog->thread, NULL, run_watchdog, dog);
+}
+
+void stop_watchdog (watchdog* dog) {
+    pthread_mutex_lock(&dog->lock);
+    dog->done = 1;
+    pthread_cond_signal(&dog->wake);
+    pthread_mutex_unlock(&dog->lock);
+
+    pthread_join(dog->thread, NULL);
+    pthread_cond_destroy(&dog->wake);
+    pthread_mutex_destroy(&dog->lock);
+}
+
+void* run_watchdog (void* arg) {
+    watchdog* dog = arg;
+
+    pthread_mutex_lock(&dog->lock);
+    while (!dog->done) {
+        double now = solsys_now();
+        if (dog->deadline > 0 && now >= dog->deadline && !dog->queue->expired) {
+            dog->queue->expired = 1;
+            debug_log(dog->queue->ctx, "Deadline reached; unfactored composites are left pending\n");
+        }
+
+        // As in solsys_stop_sieving, msieve is only stopped while it sieves,
+        // since stopping its linear algebra corrupts its state. Runs in
+        // another phase are checked again every 10 ms until the request ends.
+        double next = dog->interval > 0 ? dog->next_save : dog->deadline;
+        if (dog->queue->expired) {
+            for (int ii = 0; ii < dog->count; ii++) {
+                msieve_obj* obj = dog->workers[ii].curr;
+                if (obj != NULL && (obj->flags & MSIEVE_FLAG_SIEVING_IN_PROGRESS)) {
+                    obj->flags |= MSIEVE_FLAG_STOP_SIEVING;
+                }
+            }
+            next = now + 0.01;
+        } else if (dog->deadline > 0 && dog->deadline < next) {
+            next = dog->deadline;
+        }
+
+        if (dog->interval > 0 && now >= dog->next_save) {
+            save_checkpoint(dog);
+            dog->next_save = solsys_now() + dog->interval;
+            continue;
+        }
+
+        struct timespec until;
+        until.tv_sec = (time_t) next;
+        until.tv_nsec = (long) ((next - until.tv_sec) * 1e9);
+        pthread_cond_timedwait(&dog->wake, &dog->lock, &until);
+    }
+    pthread_mutex_unlock(&dog->lock);
+
+    return NULL;
+}
+
+// Whether the watchdog saves the checkpoint periodically
+int solsys_checkpointing (solsys_ctx* ctx) {
+    return ctx->checkpoint != NULL && ctx->checkpoint->path != NULL && ctx->checkpoint_interval_ms > 0;
+}
+
+// Saves the context's checkpoint with the savefiles of the msieve runs in
+// progress, so a process that dies mid-run loses at most an interval of
+// sieving
+void save_checkpoint (watchdog* dog) {
+    solsys_ctx* ctx = dog->queue->ctx;
+    for (int ii = 0; ii < dog->count; ii++) {
+        char* input = dog->workers[ii].running;
+        if (input != NULL) checkpoint_read_file(ctx->checkpoint, input, worker_savefile(&dog->workers[ii], input));
+    }
+    checkpoint_save(ctx->checkpoint);
+    debug_log(ctx, "Saved checkpoint %s\n", ctx->checkpoint->path);
+}
+
+/*--------------------------------------------------------------------*/
+// UTILS FOR SETTING UP AN MSIEVE OBJ
+
+// Asks every msieve run that is sieving to stop, failing its request, and
+// returns how many were asked. It only sets flags, so a signal handler of the
+// embedding program may call it; solsys installs no handlers of its own.
+int solsys_stop_sieving () {
+
+	int stopped = 0;
+
+	for (int ii = 0; ii < SOLSYS_MAX_WORKERS; ii++) {
+		worker *w = g_workers[ii];
+		msieve_obj *obj = w ? w->curr : NULL;
+		if (obj && (obj->flags & MSIEVE_FLAG_SIEVING_IN_PROGRESS)) {
+			obj->flags |= MSIEVE_FLAG_STOP_SIEVING;
+			stopped++;
+		}
+	}
+
+	return stopped;
+}
+
+// msieve's view of the machine and the seed for every thread's generator,
+// set up once per process instead of for every run
+msieve_environment g_msieve_environment;
+pthread_once_t g_msieve_environment_once = PTHREAD_ONCE_INIT;
+
+void init_msieve_environment () {
+	msieve_environment *env = &g_msieve_environment;
+
+	get_cache_sizes(&env->cache_size1, &env->cache_size2);
+	env->cpu = get_cpu_type();
+
+	/* Every msieve object should have two unique, non-correlated
+	   seeds; they come from per-thread generators that all start
+	   from this one, read from /dev/urandom where there is one */
+
+	FILE *rand_device = fopen("/dev/urandom", "r");
+	if (rand_device == NULL ||
+	    fread(&env->seed, sizeof(env->seed), (size_t)1, rand_device) != 1) {
+		env->seed = read_clock() ^ ((uint64)time(NULL) << 32) ^ (uint64)getpid();
+	}
+	if (rand_device != NULL)
+		fclose(rand_device);
+
+#ifdef HAVE_MPI
+	{
+		int32 level;
+		if ((i = MPI_Init_thread(&argc, &argv,
+				MPI_THREAD_FUNNELED, &level)) != MPI_SUCCESS) {
+			fprintf(stderr, "error %d initializing MPI, aborting\n", i);
+			MPI_Abort(MPI_COMM_WORLD, i);
+		}
+	}
+#endif
+}
+
+// msieve proves its factors prime with an APR-CL test that keeps its working
+// values in globals, so concurrent runs take turns at it. Every link of
+// solsys passes -Wl,--wrap=mpz_aprcl to route msieve's calls through here.
+int __real_mpz_aprcl(mpz_t n);
+
+int __wrap_mpz_aprcl (mpz_t n) {
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&lock);
+    int status = __real_mpz_aprcl(n);
+    pthread_mutex_unlock(&lock);
+    return status;
+}
+
+msieve_environment * get_msieve_environment () {
+    pthread_once(&g_msieve_environment_once, init_msieve_environment);
+    return &g_msieve_environment;
+}
+
+// splitmix64: a Weyl sequence through a 64-bit mixer, so threads whose
+// states differ by a constant still draw unrelated values
+static inline uint64_t splitmix64 (uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Seeds for an msieve run from the calling thread's own generator, which
+// needs no system call once the thread has drawn its first seeds
+void get_random_seeds (uint32* seed1, uint32* seed2) {
+    static uint64_t threads = 0;
+    static __thread uint64_t state;
+    static __thread int seeded = 0;
+
+    if (!seeded) {
+        uint64_t stream = __sync_add_and_fetch(&threads, 1);
+        state = get_msieve_environment()->seed ^ splitmix64(&stream);
+        seeded = 1;
+    }
+
+    uint64_t r = splitmix64(&state);
+    *seed1 = (uint32) r;
+    *seed2 = (uint32) (r >> 32);
+}
+
+/*--------------------------------------------------------------------*/
+
+// Expected seconds for msieve to factor a hard composite of the given digit
+// count. Its quadratic sieve roughly doubles in cost every four digits, from
+// about 40 s at 70 digits.
+double msieve_predict (int digits) {
+    return 40.0 * pow(2.0, (digits - 70) / 4.0);
+}
+
+msieve_obj * run_default_msieve (worker* w, char * input) {
+    char* savefile = worker_savefile(w, input);
+    msieve_obj* o = make_default_msieve_obj(savefile);
+
+    if (o == NULL) {
+        fprintf(stderr, "factoring initialization failed for %s\n", input);
+        if (w->queue != NULL) fail_work(w->queue);
+        return NULL;
+    }
+
+    o->input = input;
+    o->seed1 = w->seed1;
+    o->seed2 = w->seed2;
+    // Past the deadline, a run that has not started is not worth starting
+    if (w->queue != NULL && w->queue->expired) {
+        msieve_obj_free(o);
+        return NULL;
+    }
+
+    // Nor is one that cannot finish before it, since msieve is slow to stop
+    if (w->queue != NULL && w->queue->deadline > 0
+        && msieve_predict(strlen(input)) > w->queue->deadline - solsys_now()) {
+        debug_log(w->ctx, "msieve would overrun the deadline; leaving %s pending\n", input);
+        w->deferred = 1;
+        msieve_obj_free(o);
+        return NULL;
+    }
+
+    // A run checkpointed by an earlier process goes on from its savefile
+    if (checkpoint_write_file(w->ctx->checkpoint, input, savefile)) {
+        debug_log(w->ctx, "Resuming msieve savefile for %s\n", input);
+    }
+
+    w->running = input;
+    w->curr = o;
+    msieve_run(o);
+    w->curr = NULL;
+    w->running = NULL;
+    w->seed1 = o->seed1;
+    w->seed2 = o->seed2;
+
+    // A run stopped by the deadline or by a signal is abandoned; the caller
+    // leaves its composite pending, and its relations so far go into the
+    // checkpoint. A signal fails the whole request.
+    if (!(o->flags & MSIEVE_FLAG_FACTORIZATION_DONE)) {
+        if (w->queue == NULL || !w->queue->expired) {
+            fprintf(stderr, "\ncurrent factorization '%s' was interrupted\n", input);
+            if (w->queue != NULL) fail_work(w->queue);
+        }
+        checkpoint_read_file(w->ctx->checkpoint, input, savefile);
+        msieve_obj_free(o);
+        return NULL;
+    }
+    checkpoint_remove(w->ctx->checkpoint, CHECKPOINT_SAVEFILE, input);
+
+    // Relations in memory are given back as soon as the run is done
+    if (savefile == w->memory_savefile_name) ftruncate(w->memory_fd, 0);
+
+    return o;
+}
+
+msieve_obj * make_default_msieve_obj(char *savefile_name) {
+
+	char *logfile_name = NULL;
+	char *infile_name = "worktodo.ini";
+	char *nfs_fbfile_name = NULL;
+	uint32 flags;
+	uint32 max_relations = 0;
+	uint32 num_threads = 0;
+	uint32 which_gpu = 0;
+	const char *nfs_args = NULL;
+
+	flags = MSIEVE_FLAG_USE_LOGFILE;
+    flags &= ~(MSIEVE_FLAG_USE_LOGFILE | MSIEVE_FLAG_LOG_TO_STDOUT);
+
+	msieve_environment *env = get_msieve_environment();
+
+    msieve_obj* o = msieve_obj_new(NULL, flags,
+			    savefile_name, logfile_name,
+			    nfs_fbfile_name,
+			    0, 0, max_relations,
+			    env->cpu,
+			    env->cache_size1, env->cache_size2,
+			    num_threads, which_gpu, 
+			    nfs_args);
+
+    return o;
+}
+
+/*--------------------------------------------------------------------*/
+// FACTOR LISTS, FROM MSIEVE OR FROM THE CACHE FILE
+
+// Factor lists are stored as space separated <type><number> pairs,
+// e.g. "p2 p2 p3" for 12
+char* encode_msieve_factors (msieve_factor* factors) {
+    size_t length = 1;
+    for (msieve_factor* f = factors; f != NULL; f = f->next) {
+        length += strlen(f->number) + 2;
+    }
+
+    char* out = malloc(length);
+    char* pos = out;
+    for (msieve_factor* f = factors; f != NULL; f = f->next) {
+        char type = 'p';
+        if (f->factor_type == MSIEVE_COMPOSITE) type = 'c';
+        else if (f->factor_type == MSIEVE_PROBABLE_PRIME) type = 'q';
+
+        if (pos != out) *pos++ = ' ';
+        *pos++ = type;
+        strcpy(pos, f->number);
+        pos += strlen(f->number);
+    }
+    *pos = '\0';
+
+    return out;
+}
+
+msieve_factor* decode_msieve_factors (char* encoded) {
+    msieve_factor* head = NULL;
+    msieve_factor** tail = &head;
+
+    char* save = NULL;
+    for (char* tok = strtok_r(encoded, " ", &save); tok != NULL; tok = strtok_r(NULL, " ", &save)) {
+        msieve_factor* f = malloc(sizeof(msieve_factor));
+        f->factor_type = MSIEVE_PRIME;
+        if (tok[0] == 'c') f->factor_type = MSIEVE_COMPOSITE;
+        else if (tok[0] == 'q') f->factor_type = MSIEVE_PROBABLE_PRIME;
+        f->number = strdup(tok + 1);
+        f->next = NULL;
+
+        *tail = f;
+        tail = &f->next;
+    }
+
+    return head;
+}
+
+void free_msieve_factors (msieve_factor* factors) {
+    while (factors != NULL) {
+        msieve_factor* next = factors->next;
+        free(factors->number);
+        free(factors);
+        factors = next;
+    }
+}
+
+// Parses a decimal string into a uint64_t, failing if it does not fit
+int parse_u64 (char* input, uint64_t* out) {
+    if (input[0] < '0' || input[0] > '9') return 0;
+
+    char* end;
+    errno = 0;
+    unsigned long long value = strtoull(input, &end, 10);
+    if (errno != 0 || *end != '\0') return 0;
+
+    *out = value;
+    return 1;
+}
+
+// Factorizes a word-sized value in-process, building the same ascending list
+// of proven primes that msieve would return
+msieve_factor* factor_small (uint64_t n) {
+    uint64_t primes[FACTOR64_MAX];
+    int count = factor_u64(n, primes);
+    return factor_list_u64(primes, count);
+}
+
+// Answers n from the running range's segment, or returns NULL if it has none
+msieve_factor* factor_from_range (solsys_ctx* ctx, uint64_t n) {
+    uint64_t primes[FACTOR64_MAX];
+    int count = -1;
+
+    pthread_rwlock_rdlock(&ctx->range_lock);
+    if (ctx->range != NULL) count = factor_segment_factors(ctx->range, n, primes);
+    pthread_rwlock_unlock(&ctx->range_lock);
+
+    return count < 0 ? NULL : factor_list_u64(primes, count);
+}
+
+// The msieve factor list of ascending primes
+msieve_factor* factor_list_u64 (uint64_t* primes, int count) {
+    msieve_factor* head = NULL;
+    for (int ii = count - 1; ii >= 0; ii--) {
+        msieve_factor* f = malloc(sizeof(msieve_factor));
+        f->factor_type = MSIEVE_PRIME;
+        f->number = malloc(21);
+        snprintf(f->number, 21, "%" PRIu64, primes[ii]);
+        f->next = head;
+        head = f;
+    }
+
+    return head;
+}
+
+// Returns the ascending factor list of input, owned by the caller
+// Word-sized values are factored directly; anything larger is answered from
+// the cache file when possible, otherwise by msieve, recording the result for
+// later runs
+msieve_factor* collect_factors (worker* w, char* input) {
+    uint64_t small;
+    if (parse_u64(input, &small) && small >= 2) {
+        msieve_factor* factors = factor_from_range(w->ctx, small);
+        if (factors != NULL) {
+            node_answered(w, node_source_range);
+            return factors;
+        }
+        return factor_small(small);
+    }
+
+    char* stored = store_get(w->ctx->cache_file, STORE_FACTORS, input);
+    if (stored != NULL) {
+        debug_log(w->ctx, "Cached factorization: %s\n", input);
+        node_answered(w, node_source_store);
+        msieve_factor* factors = decode_msieve_factors(stored);
+        free(stored);
+        return factors;
+    }
+
+    stored = checkpoint_get(w->ctx->checkpoint, CHECKPOINT_FACTORS, input, NULL);
+    if (stored != NULL) {
+        debug_log(w->ctx, "Checkpointed factorization: %s\n", input);
+        node_answered(w, node_source_checkpoint);
+        msieve_factor* factors = decode_msieve_factors(stored);
+        free(stored);
+        return factors;
+    }
+
+    msieve_factor* factors = factor_pipeline(w, input);
+    if (factors == NULL) return NULL;
+
+    if (w->ctx->cache_file != NULL || w->ctx->checkpoint != NULL) {
+        char* encoded = encode_msieve_factors(factors);
+        store_put(w->ctx->cache_file, STORE_FACTORS, input, encoded);
+        checkpoint_put(w->ctx->checkpoint, CHECKPOINT_FACTORS, input, encoded, strlen(encoded));
+        free(encoded);
+    }
+
+    return factors;
+}
+
+/*--------------------------------------------------------------------*/
+// FACTORING PIPELINE
+
+// A value too large for factor64 passes through stages of rising cost, and
+// msieve only sieves what survives all of them:
+//   trial division by the primes below TRIAL_DIVISION_LIMIT
+//   a BPSW probable prime test, as many spacers and powers are prime
+//   perfect power detection, so p^k is split without sieving
+//   Pollard's p - 1 up to PM1_BOUND, for factors with smooth p - 1
+//   msieve, whose own rho and MPQS take the stubborn cofactor
+
+// Returns the ascending factor list of input, or NULL if msieve was stopped
+// or failed first
+msieve_factor* factor_pipeline (worker* w, char* input) {
+    mpz_t n;
+    mpz_init_set_str(n, input, 10);
+    msieve_factor* found = NULL;
+
+    trial_divide(w->ctx, n, &found);
+    node_answered(w, node_source_trial);
+    if (!split_cofactor(w, n, &found)) {
+        free_msieve_factors(found);
+        found = NULL;
+    } else {
+        found = sort_msieve_factors(found);
+    }
+
+    mpz_clear(n);
+    return found;
+}
+
+// Divides out every prime below TRIAL_DIVISION_LIMIT, adding each to found
+void trial_divide (solsys_ctx* ctx, mpz_t n, msieve_factor** found) {
+    double start = solsys_now();
+    int divided = 0;
+
+    unsigned long twos = mpz_scan1(n, 0);
+    for (unsigned long ii = 0; ii < twos; ii++) add_factor_ui(found, 2);
+    mpz_tdiv_q_2exp(n, n, twos);
+    divided |= twos > 0;
+
+    acquire_sieving_primes(TRIAL_DIVISION_LIMIT);
+    for (uint64_t ii = 0; ii < sieving_prime_count && sieving_primes[ii] < TRIAL_DIVISION_LIMIT; ii++) {
+        uint32_t p = sieving_primes[ii];
+        if (mpz_cmp_ui(n, (unsigned long) p * p) < 0) break;
+        while (mpz_divisible_ui_p(n, p)) {
+            mpz_divexact_ui(n, n, p);
+            add_factor_ui(found, p);
+            divided = 1;
+        }
+    }
+    release_sieving_primes();
+
+    // What is left below the square of the limit is 1 or a prime
+    if (mpz_cmp_ui(n, 1) > 0 && mpz_cmp_ui(n, (unsigned long) TRIAL_DIVISION_LIMIT * TRIAL_DIVISION_LIMIT) < 0) {
+        add_factor(found, n, MSIEVE_PRIME);
+        mpz_set_ui(n, 1);
+    }
+
+    factor_stage_record(ctx, factor_stage_trial, divided, start);
+}
+
+// Adds the prime factors of n, free of small primes, to found by the
+// cheapest stage that splits it; returns 0 if msieve was stopped or failed
+int split_cofactor (worker* w, mpz_t n, msieve_factor** found) {
+    solsys_ctx* ctx = w->ctx;
+    if (mpz_cmp_ui(n, 1) <= 0) return 1;
+
+    if (mpz_sizeinbase(n, 2) <= 64) {
+        uint64_t primes[FACTOR64_MAX];
+        int count = factor_u64(mpz_get_ui(n), primes);
+        for (int ii = 0; ii < count; ii++) add_factor_ui(found, primes[ii]);
+        return 1;
+    }
+
+    // From 25 rounds GMP runs BPSW, followed by reps - 24 Miller-Rabin tests
+    double start = solsys_now();
+    int prime = mpz_probab_prime_p(n, 25);
+    factor_stage_record(ctx, factor_stage_prime, prime, start);
+    if (prime) {
+        node_answered(w, node_source_prime);
+        add_factor(found, n, MSIEVE_PROBABLE_PRIME);
+        return 1;
+    }
+
+    int ok = 1;
+    mpz_t root, cofactor;
+    mpz_init(root);
+    mpz_init(cofactor);
+
+    start = solsys_now();
+    unsigned long power = perfect_power(n, root);
+    factor_stage_record(ctx, factor_stage_power, power > 1, start);
+    if (power > 1) {
+        node_answered(w, node_source_power);
+        msieve_factor* root_factors = NULL;
+        ok = split_cofactor(w, root, &root_factors);
+        for (unsigned long ii = 0; ii < power; ii++) {
+            for (msieve_factor* f = root_factors; f != NULL; f = f->next) {
+                add_factor_str(found, f->number, f->factor_type);
+            }
+        }
+        free_msieve_factors(root_factors);
+    } else {
+        start = solsys_now();
+        int split = pm1_split(n, root);
+        factor_stage_record(ctx, factor_stage_pm1, split, start);
+        if (split) {
+            node_answered(w, node_source_pm1);
+            mpz_divexact(cofactor, n, root);
+            ok = split_cofactor(w, root, found) && split_cofactor(w, cofactor, found);
+        } else {
+            ok = msieve_cofactor(w, n, found);
+        }
+    }
+
+    mpz_clear(root);
+    mpz_clear(cofactor);
+    return ok;
+}
+
+// The largest k for which n is a k-th power, setting root to its k-th root,
+// or 1 if n is no perfect power
+unsigned long perfect_power (mpz_t n, mpz_t root) {
+    if (!mpz_perfect_power_p(n)) return 1;
+
+    unsigned long power = 1;
+    mpz_t r;
+    mpz_init(r);
+    for (unsigned long k = 2; k < mpz_sizeinbase(n, 2); k++) {
+        if (mpz_root(r, n, k)) {
+            power = k;
+            mpz_set(root, r);
+        }
+    }
+    mpz_clear(r);
+    return power;
+}
+
+// Pollard's p - 1, stage one: finds a factor p of n whose p - 1 has no prime
+// power above PM1_BOUND. Sets g to it and returns 1, or returns 0.
+int pm1_split (mpz_t n, mpz_t g) {
+    mpz_t a;
+    mpz_init_set_ui(a, 2);
+
+    unsigned long two_power = 2;
+    while (two_power * 2 <= PM1_BOUND) two_power *= 2;
+    mpz_powm_ui(a, a, two_power, n);
+
+    acquire_sieving_primes(PM1_BOUND);
+    for (uint64_t ii = 0; ii < sieving_prime_count && sieving_primes[ii] <= PM1_BOUND; ii++) {
+        unsigned long q = sieving_primes[ii];
+        while (q * sieving_primes[ii] <= PM1_BOUND) q *= sieving_primes[ii];
+        mpz_powm_ui(a, a, q, n);
+    }
+    release_sieving_primes();
+
+    mpz_sub_ui(a, a, 1);
+    mpz_gcd(g, a, n);
+    mpz_clear(a);
+
+    // g = n means every factor was found at once, which splits nothing
+    return mpz_cmp_ui(g, 1) > 0 && mpz_cmp(g, n) < 0;
+}
+
+// Hands n to msieve, adding the factors it finds to found; returns 0 if the
+// deadline stopped or deferred it or the run failed, which fails the request
+int msieve_cofactor (worker* w, mpz_t n, msieve_factor** found) {
+    // The input outlives the run in the worker's scratch, since checkpoints
+    // may read it meanwhile
+    char* input = arena_alloc(&w->scratch, mpz_sizeinbase(n, 10) + 2);
+    mpz_get_str(input, 10, n);
+
+    node_answered(w, node_source_msieve);
+    double start = solsys_now();
+    msieve_obj* o = run_default_msieve(w, input);
+    factor_stage_record(w->ctx, factor_stage_msieve, o != NULL, start);
+    if (o == NULL) return 0;
+
+    for (msieve_factor* f = o->factors; f != NULL; f = f->next) {
+        add_factor_str(found, f->number, f->factor_type);
+    }
+    msieve_obj_free(o);
+    return 1;
+}
+
+void add_factor_str (msieve_factor** found, const char* number, enum msieve_factor_type type) {
+    msieve_factor* f = malloc(sizeof(msieve_factor));
+    f->factor_type = type;
+    f->number = strdup(number);
+    f->next = *found;
+    *found = f;
+}
+
+void add_factor (msieve_factor** found, mpz_t p, enum msieve_factor_type type) {
+    char* number = malloc(mpz_sizeinbase(p, 10) + 2);
+    mpz_get_str(number, 10, p);
+    add_factor_str(found, number, type);
+    free(number);
+}
+
+void add_factor_ui (msieve_factor** found, uint64_t p) {
+    char number[21];
+    snprintf(number, sizeof(number), "%" PRIu64, p);
+    add_factor_str(found, number, MSIEVE_PRIME);
+}
+
+// Decimal strings without leading zeros order by length, then digits
+int compare_msieve_factors (const void* a, const void* b) {
+    const char* x = (*(msieve_factor* const*) a)->number;
+    const char* y = (*(msieve_factor* const*) b)->number;
+    size_t lx = strlen(x), ly = strlen(y);
+    if (lx != ly) return lx < ly ? -1 : 1;
+    return strcmp(x, y);
+}
+
+// Factors in ascending order, as msieve lists them
+msieve_factor* sort_msieve_factors (msieve_factor* factors) {
+    size_t count = 0;
+    for (msieve_factor* f = factors; f != NULL; f = f->next) count++;
+    if (count < 2) return factors;
+
+    msieve_factor** all = malloc(sizeof(msieve_factor*) * count);
+    count = 0;
+    for (msieve_factor* f = factors; f != NULL; f = f->next) all[count++] = f;
+    qsort(all, count, sizeof(msieve_factor*), compare_msieve_factors);
+
+    for (size_t ii = 0; ii + 1 < count; ii++) all[ii]->next = all[ii + 1];
+    all[count - 1]->next = NULL;
+    msieve_factor* head = all[0];
+    free(all);
+    return head;
+}
+
+// Adds a value handed to a stage to its totals, with whether the stage
+// settled it
+void factor_stage_record (solsys_ctx* ctx, enum factor_stage stage, int settled, double start) {
+    double elapsed = solsys_now() - start;
+    pthread_mutex_lock(&ctx->factor_stats_lock);
+    ctx->factor_stages[stage].calls++;
+    ctx->factor_stages[stage].settled += settled != 0;
+    ctx->factor_stages[stage].seconds += elapsed;
+    pthread_mutex_unlock(&ctx->factor_stats_lock);
+}
+
+composite* factor_composite (solsys_ctx* ctx, const char* number) {
+    composite* tree;
+    factor_composites(ctx, &number, 1, &tree);
+    return tree;
+}
+
+// Builds the trees of count numbers through one queue, so the workers stay
+// busy across the whole batch and work the trees share is done once. Returns
+// 0, with every tree NULL, if a number is not a non-negative integer, before
+// doing anything, or if a factorization failed or was interrupted; what the
+// request had found is then kept in the cache and the checkpoint.
+int factor_composites (solsys_ctx* ctx, const char** numbers, int count, composite** trees) {
+    mpz_t n;
+    mpz_init(n);
+    for (int ii = 0; ii < count; ii++) {
+        if (mpz_set_str(n, numbers[ii], 0) != 0 || mpz_sgn(n) < 0) {
+            mpz_clear(n);
+            for (int jj = 0; jj < count; jj++) trees[jj] = NULL;
+            return 0;
+        }
+    }
+
+    // Every composite a request finds in the cache is then either finished or
+    // pending, never still queued by another request
+    pthread_mutex_lock(&ctx->request_lock);
+
+    workqueue queue;
+    init_workqueue(&queue, ctx);
+
+    int thread_count = ctx->threads;
+    worker* workers = malloc(sizeof(worker) * thread_count);
+    pthread_t* threads = malloc(sizeof(pthread_t) * thread_count);
+    for (int ii = 0; ii < thread_count; ii++) {
+        init_worker(&workers[ii], ii, ctx, &queue);
+    }
+
+    // Equal numbers, however written, get the same composite from the cache.
+    // The checkpoint keeps each root until its tree is finished, and the
+    // results found on the way under the request's generation.
+    unsigned long generation = checkpoint_begin(ctx->checkpoint);
+    char** roots = malloc(sizeof(char*) * count);
+    for (int ii = 0; ii < count; ii++) {
+        mpz_set_str(n, numbers[ii], 0);
+        treeint root;
+        treeint_view_mpz(&root, n);
+        roots[ii] = treeint_get_str(&root);
+        checkpoint_put(ctx->checkpoint, CHECKPOINT_ROOT, roots[ii], "", 0);
+        trees[ii] = schedule_factorization(&workers[0], &root);
+    }
+    mpz_clear(n);
+
+    register_workers(workers, thread_count);
+    watchdog dog;
+    int watched = ctx->deadline_ms > 0 || solsys_checkpointing(ctx);
+    if (watched) start_watchdog(&dog, &queue, workers, thread_count);
+
+    // The calling thread acts as worker 0, so -j 1 spawns no threads at all
+    for (int ii = 1; ii < thread_count; ii++) {
+        pthread_create(&threads[ii], NULL, run_worker, &workers[ii]);
+    }
+    run_worker(&workers[0]);
+    for (int ii = 1; ii < thread_count; ii++) {
+        pthread_join(threads[ii], NULL);
+    }
+
+    if (watched) stop_watchdog(&dog);
+    unregister_workers(workers, thread_count);
+
+    pthread_mutex_lock(&ctx->stats_lock);
+    unsigned long request = ctx->requests++;
+    pthread_mutex_unlock(&ctx->stats_lock);
+    if (ctx->trace_path != NULL) write_trace(ctx, workers, thread_count, request);
+    for (int ii = 0; ii < thread_count; ii++) {
+        merge_worker_stats(&workers[ii]);
+        free(workers[ii].trace);
+    }
+
+    for (int ii = 0; ii < count; ii++) {
+        if (!queue.expired) checkpoint_remove(ctx->checkpoint, CHECKPOINT_ROOT, roots[ii]);
+        free(roots[ii]);
+    }
+    free(roots);
+
+    // Finished results are left to the store, so the checkpoint only grows
+    // with unfinished trees: a finished request drops its own, and once no
+    // tree is unfinished, earlier requests' go too
+    int results = CHECKPOINT_FACTORS | CHECKPOINT_PI | CHECKPOINT_LI;
+    if (!queue.expired) checkpoint_forget(ctx->checkpoint, results, generation);
+    if (checkpoint_count(ctx->checkpoint, CHECKPOINT_ROOT) == 0) checkpoint_clear(ctx->checkpoint, results);
+    checkpoint_save(ctx->checkpoint);
+
+    // New nodes may be shared by later requests through the cache, so they
+    // join the context's arena; everything else of the request goes at once
+    unsigned long node_allocations = 0, scratch_allocations = 0, chunks = 0;
+    pthread_mutex_lock(&ctx->nodes_lock);
+    for (int ii = 0; ii < thread_count; ii++) {
+        node_allocations += workers[ii].nodes.allocations;
+        scratch_allocations += workers[ii].scratch.allocations;
+        chunks += workers[ii].nodes.chunk_count + workers[ii].scratch.chunk_count;
+        arena_adopt(&ctx->nodes, &workers[ii].nodes);
+        arena_free(&workers[ii].scratch);
+        close_savefiles(&workers[ii]);
+    }
+    pthread_mutex_unlock(&ctx->nodes_lock);
+    debug_log(ctx, "Request allocations: %lu node, %lu scratch, in %lu chunks\n",
+              node_allocations, scratch_allocations, chunks);
+
+    int ok = !queue.failed;
+    if (!ok) {
+        for (int ii = 0; ii < count; ii++) trees[ii] = NULL;
+    }
+
+    free(threads);
+    free(workers);
+    free_workqueue(&queue);
+    pthread_mutex_unlock(&ctx->request_lock);
+    return ok;
+}
+
+// Factorize one worklist item and attach its factor groups to its composite.
+// Only the worker holding the item touches that composite, so no locking is
+// needed beyond scheduling the power and spacer sub-composites.
+void expand_composite (worker* w, worklist* curr) {
+    debug_log(w->ctx, "Factoring possible composite: %s\n", curr->todo);
+    double start = solsys_now();
+    w->source = node_source_factor64;
+    w->deferred = 0;
+    msieve_factor* factors = collect_factors(w, curr->todo);
+    if (factors == NULL && (w->queue->expired || w->deferred)) {
+        curr->output->pending = 1;
+        return;
+    }
+
+    int factor_count = 0;
+    for (msieve_factor* f = factors; f != NULL; f = f->next) factor_count++;
+    int* powers = arena_alloc(&w->scratch, sizeof(int) * (factor_count + 1));
+    treeint** bases = arena_alloc(&w->scratch, sizeof(treeint*) * (factor_count + 1));
+    treeint** pis = arena_alloc(&w->scratch, sizeof(treeint*) * (factor_count + 1));
+
+    // Group repeated factors, counting the power of each group
+    msieve_factor* msieve_factor = factors;
+    treeint parsed_factor;
+    factor* factor_group = NULL;
+    int group_count = 0;
+    while (msieve_factor != NULL) {
+        treeint_set_str(&parsed_factor, msieve_factor->number, &w->scratch);
+
+        if (factor_group != NULL) {
+            debug_log(w->ctx, "Comparing: %s %d\n", msieve_factor->number, msieve_factor_eq_factor_group(factor_group, &parsed_factor));
+        }
+
+        if (msieve_factor_eq_factor_group(factor_group, &parsed_factor)) {
+            powers[group_count - 1]++;
+        } else {
+            // Create a new factor_group
+            factor_group = initialize_factor_group(&w->nodes, curr->output, factor_group, msieve_factor, &parsed_factor);
+            bases[group_count] = &factor_group->base;
+            pis[group_count] = &factor_group->pi;
+            powers[group_count] = 1;
+            group_count++;
+        }
+
+        msieve_factor = msieve_factor->next;
+    }
+
+    // Bases arrive in ascending order, so their pi values are computed
+    // together, then the powers and spacers that depend on them are scheduled
+    double pi_start = solsys_now();
+    pix_batch(w->ctx, bases, pis, group_count, &w->nodes);
+    double schedule_start = solsys_now();
+
+    int ii = 0;
+    for (factor_group = curr->output->factors; factor_group != NULL; factor_group = factor_group->next) {
+        // Schedule a power to be factorized if necessary
+        schedule_power(w, factor_group, powers[ii++]);
+        // Schedule a spacer if necessary
+        schedule_spacer(w, factor_group);
+    }
+
+    free_msieve_factors(factors);
+
+    double end = solsys_now();
+    w->schedule.calls++;
+    w->schedule.seconds += end - schedule_start;
+    w->expanded++;
+    w->expand_seconds += end - start;
+    w->node_sources[w->source]++;
+    if (w->ctx->trace_path != NULL) trace_node(w, curr, start, schedule_start - pi_start);
+}
+
+int msieve_factor_eq_factor_group (factor* factor_group, treeint* parsed_factor) {
+    return factor_group != NULL && treeint_cmp(&factor_group->base, parsed_factor) == 0;
+}
+
+factor* initialize_factor_group (arena* nodes, composite* parent, factor* previous_group, msieve_factor* source, treeint* parsed) {
+    factor* new_group = arena_alloc(nodes, sizeof(factor));
+
+    // Link to previous group, or to parent if no previous group exists
+    if (previous_group == NULL) {
+        parent->factors = new_group;
+        new_group->prev = NULL;
+    } else {
+        previous_group->next = new_group;
+        new_group->prev = previous_group;
+    }
+
+    // Set next as NULL, copy source to base
+    new_group->next = NULL;
+    new_group->factor_type = source->factor_type;
+    treeint_copy(&new_group->base, parsed, nodes);
+
+    // pi is filled in once every group of the parent exists, see pix_batch
+    return new_group;
+}
+
+// Loads the pi table on first use, or builds it (saving it for later runs if
+// a path was given), so runs that never need a small pi value pay nothing
+pi_table* get_pi_table (solsys_ctx* ctx) {
+    if (__atomic_load_n(&ctx->pi_table_ready, __ATOMIC_ACQUIRE)) return ctx->pi_table;
+
+    pthread_mutex_lock(&ctx->pi_table_lock);
+    if (!ctx->pi_table_ready) {
+        if (ctx->pi_table_path != NULL) ctx->pi_table = pi_table_load(ctx->pi_table_path, ctx->pi_table_bound);
+        if (ctx->pi_table == NULL) {
+            debug_log(ctx, "Building pi table up to %" PRIu64 "\n", ctx->pi_table_bound);
+            ctx->pi_table = pi_table_build(ctx->pi_table_bound);
+            if (ctx->pi_table_path != NULL && !pi_table_save(ctx->pi_table, ctx->pi_table_path)) {
+                fprintf(stderr, "could not save pi table to %s\n", ctx->pi_table_path);
+            }
+        }
+        __atomic_store_n(&ctx->pi_table_ready, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&ctx->pi_table_lock);
+
+    return ctx->pi_table;
+}
+
+// Answers pi(x) from the running range's segment if x lies in it
+int pix_from_range (solsys_ctx* ctx, uint64_t x, treeint* result) {
+    double start = solsys_now();
+    int found = 0;
+
+    pthread_rwlock_rdlock(&ctx->range_lock);
+    factor_segment* f = ctx->range;
+    if (f != NULL && ctx->range_pi_known && x >= f->lo && x - f->lo < f->span) {
+        treeint_set_ui(result, ctx->range_pi_before + f->prime_counts[x - f->lo]);
+        found = 1;
+    }
+    pthread_rwlock_unlock(&ctx->range_lock);
+
+    if (found) pi_tier_record(ctx, pi_tier_range, 1, start);
+    return found;
+}
+
+// Answers pi(x) from a running range or from the table if it is enabled and
+// covers x
+int pix_from_table (solsys_ctx* ctx, treeint* x, treeint* result) {
+    if (x->big != NULL) return 0;
+    if (pix_from_range(ctx, x->word, result)) return 1;
+    if (!ctx->pi_table_enabled) return 0;
+
+    pi_table* t = get_pi_table(ctx);
+    if (x->word > t->bound) return 0;
+
+    double start = solsys_now();
+    treeint_set_ui(result, pi_table_lookup(t, x->word));
+    pi_tier_record(ctx, pi_tier_table, 1, start);
+    return 1;
+}
+
+// Looks x up in the cache file, setting result if it was stored
+// Exact and approximate values are stored apart, since the threshold
+// between them may differ from run to run
+int pix_lookup (solsys_ctx* ctx, treeint* x, treeint* result, int exact, arena* a) {
+    if (ctx->cache_file == NULL && ctx->checkpoint == NULL) return 0;
+
+    char* key = treeint_get_str(x);
+    char* stored = store_get(ctx->cache_file, exact ? STORE_PI : STORE_LI, key);
+    if (stored == NULL) stored = checkpoint_get(ctx->checkpoint, exact ? CHECKPOINT_PI : CHECKPOINT_LI, key, NULL);
+    free(key);
+    if (stored == NULL) return 0;
+
+    int ok = treeint_set_str(result, stored, a);
+    free(stored);
+    return ok;
+}
+
+void pix_record (solsys_ctx* ctx, treeint* x, treeint* result, int exact) {
+    if (ctx->cache_file == NULL && ctx->checkpoint == NULL) return;
+
+    char* key = treeint_get_str(x);
+    char* value = treeint_get_str(result);
+    store_put(ctx->cache_file, exact ? STORE_PI : STORE_LI, key, value);
+    checkpoint_put(ctx->checkpoint, exact ? CHECKPOINT_PI : CHECKPOINT_LI, key, value, strlen(value));
+    free(key);
+    free(value);
+}
+
+double solsys_now () {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Adds calls answered by a tier since start to its totals, returning the
+// time they took
+double pi_tier_record (solsys_ctx* ctx, enum pi_tier tier, unsigned long calls, double start) {
+    double elapsed = solsys_now() - start;
+    pthread_mutex_lock(&ctx->pi_stats_lock);
+    ctx->pi_tiers[tier].calls += calls;
+    ctx->pi_tiers[tier].seconds += elapsed;
+    pthread_mutex_unlock(&ctx->pi_stats_lock);
+    return elapsed;
+}
+
+// Expected seconds for primecount to count pi(x). Its cost grows like x^(2/3),
+// scaled from the latest run that took long enough to time, or until there
+// is one, from about 10 ms at 1e13.
+double primecount_predict (solsys_ctx* ctx, treeint* x) {
+    double value = x->big != NULL ? mpz_get_d(x->big) : (double) x->word;
+
+    pthread_mutex_lock(&ctx->pi_stats_lock);
+    double base_x = ctx->primecount_x > 0 ? ctx->primecount_x : 1e13;
+    double base_seconds = ctx->primecount_x > 0 ? ctx->primecount_seconds : 0.01;
+    pthread_mutex_unlock(&ctx->pi_stats_lock);
+
+    return base_seconds * pow(value / base_x, 2.0 / 3.0);
+}
+
+// Whether pi(x) is counted exactly: always below logint_threshold, never from
+// exact_limit on, and in between only while primecount fits the budget
+int pix_is_exact (solsys_ctx* ctx, treeint* x) {
+    if (treeint_cmp_mpz(x, ctx->logint_threshold) < 0) return 1;
+    if (treeint_cmp_mpz(x, ctx->exact_limit) >= 0) return 0;
+    return primecount_predict(ctx, x) <= ctx->exact_budget;
+}
+
+// Sets result to pi(x), allocating it from a if it needs promoting. Returns
+// whether the result is exact rather than li(x).
+int pix_using_threshold (solsys_ctx* ctx, treeint* x, treeint* result, arena* a) {
+    int exact = pix_is_exact(ctx, x);
+    if (exact && pix_from_table(ctx, x, result)) return 1;
+    if (pix_lookup(ctx, x, result, exact, a)) return exact;
+
+    // An x past primecount's range is approximated after all
+    double start = solsys_now();
+    if (exact && primecount_treeint(x, result, a)) {
+        double elapsed = pi_tier_record(ctx, pi_tier_primecount, 1, start);
+        if (elapsed > 0.001) {
+            pthread_mutex_lock(&ctx->pi_stats_lock);
+            ctx->primecount_x = x->big != NULL ? mpz_get_d(x->big) : (double) x->word;
+            ctx->primecount_seconds = elapsed;
+            pthread_mutex_unlock(&ctx->pi_stats_lock);
+        }
+    } else {
+        exact = 0;
+        start = solsys_now();
+        logint_treeint(ctx, x, result, a);
+        pi_tier_record(ctx, pi_tier_logint, 1, start);
+    }
+
+    pix_record(ctx, x, result, exact);
+    return exact;
+}
+
+// Computes pi for each of the ascending xs into the matching results. Only
+// the largest exact value needs a full prime count; each smaller one is
+// derived by sieving the gap to its neighbour, unless that gap is wide
+// enough that counting from scratch is cheaper, or its neighbour came back
+// approximate after all (pix_is_exact tracks the primecount timings, which
+// may move between the two calls).
+void pix_batch (solsys_ctx* ctx, treeint** xs, treeint** results, int count, arena* a) {
+    int exact = 0;
+    while (exact < count && pix_is_exact(ctx, xs[exact])) exact++;
+    pix_approximate(ctx, xs + exact, results + exact, count - exact, a);
+    if (exact == 0) return;
+
+    int neighbour_exact = pix_using_threshold(ctx, xs[exact - 1], results[exact - 1], a);
+    for (int ii = exact - 2; ii >= 0; ii--) {
+        if (pix_from_table(ctx, xs[ii], results[ii])
+            || pix_lookup(ctx, xs[ii], results[ii], 1, a)) {
+            neighbour_exact = 1;
+            continue;
+        }
+
+        // Any pi of a word-sized x is itself word-sized
+        if (neighbour_exact && xs[ii + 1]->big == NULL) {
+            uint64_t lo = xs[ii]->word;
+            uint64_t hi = xs[ii + 1]->word;
+            if (sieve_is_cheaper(lo, hi)) {
+                double start = solsys_now();
+                treeint_set_ui(results[ii], results[ii + 1]->word - count_primes_between(lo, hi));
+                pi_tier_record(ctx, pi_tier_sieve, 1, start);
+                pix_record(ctx, xs[ii], results[ii], 1);
+                continue;
+            }
+        }
+
+        neighbour_exact = pix_using_threshold(ctx, xs[ii], results[ii], a);
+    }
+}
+
+// Sets each result to li(x) in place of pi(x). The x that fit the double-double
+// kernel are evaluated together; the rest, and any the kernel cannot decide,
+// take the MPFR path one at a time.
+void pix_approximate (solsys_ctx* ctx, treeint** xs, treeint** results, int count, arena* a) {
+    if (count <= 0) return;
+
+    uint64_t* words = malloc(count * sizeof(uint64_t));
+    int64_t* fast = malloc(count * sizeof(int64_t));
+    int* pending = malloc(count * sizeof(int));
+    int batched = 0;
+
+    for (int ii = 0; ii < count; ii++) {
+        if (pix_lookup(ctx, xs[ii], results[ii], 0, a)) continue;
+
+        if (xs[ii]->big == NULL && xs[ii]->word < LOGINT_FAST_BOUND) {
+            words[batched] = xs[ii]->word;
+            pending[batched++] = ii;
+            continue;
+        }
+
+        double start = solsys_now();
+        logint_treeint(ctx, xs[ii], results[ii], a);
+        pi_tier_record(ctx, pi_tier_logint, 1, start);
+        pix_record(ctx, xs[ii], results[ii], 0);
+    }
+
+    double start = solsys_now();
+    logint_fast_batch(words, fast, batched);
+    pi_tier_record(ctx, pi_tier_logint_fast, batched, start);
+    for (int jj = 0; jj < batched; jj++) {
+        int ii = pending[jj];
+        if (fast[jj] >= 0) {
+            treeint_set_ui(results[ii], fast[jj]);
+        } else {
+            start = solsys_now();
+            logint_treeint(ctx, xs[ii], results[ii], a);
+            pi_tier_record(ctx, pi_tier_logint, 1, start);
+        }
+        pix_record(ctx, xs[ii], results[ii], 0);
+    }
+
+    free(words);
+    free(fast);
+    free(pending);
+}
+
+// Word-sized inputs go to primecount as integers; only larger ones, which
+// primecount's 128-bit backend takes as decimal strings, are converted.
+// Returns 0 if x is past what primecount can count.
+int primecount_treeint (treeint* x, treeint* result, arena* a) {
+    if (x->big == NULL && x->word <= INT64_MAX) {
+        int64_t pix = primecount_pi((int64_t) x->word);
+        if (pix < 0) return 0;
+        treeint_set_ui(result, pix);
+        return 1;
+    }
+
+    char* input = treeint_get_str(x);
+    char pix_str[64];
+    int length = primecount_pi_str(input, pix_str, sizeof(pix_str));
+    free(input);
+    if (length <= 0) return 0;
+
+    return treeint_set_str(result, pix_str, a);
+}
+
+void logint_treeint (solsys_ctx* ctx, treeint* x, treeint* result, arena* a) {
+    mpz_t input, output;
+    mpz_init(input);
+    mpz_init(output);
+    treeint_get_mpz(input, x);
+
+    logint_engine_z(ctx->logint, output, input);
+
+    treeint_set_mpz(result, output, a);
+    mpz_clear(input);
+    mpz_clear(output);
+}
+
+void schedule_spacer (worker* w, factor* factor_group) {
+    if (factor_group == NULL) return;
+
+    treeint* pi = &factor_group->pi;
+    treeint* previous = factor_group->prev != NULL ? &factor_group->prev->pi : NULL;
+    factor_group->spacer = NULL;
+
+    // pi values are ascending, so with both in words the difference is too
+    if (pi->big == NULL && (previous == NULL || previous->big == NULL)) {
+        uint64_t delta = pi->word - (previous != NULL ? previous->word : 0);
+        if (delta > 1) {
+            treeint spacer;
+            treeint_set_ui(&spacer, delta - 1);
+            factor_group->spacer = schedule_factorization(w, &spacer);
+        }
+        return;
+    }
+
+    mpz_t delta;
+    mpz_init(delta);
+    treeint_get_mpz(delta, pi);
+    if (previous != NULL) {
+        mpz_t previous_pi;
+        mpz_init(previous_pi);
+        treeint_get_mpz(previous_pi, previous);
+        mpz_sub(delta, delta, previous_pi);
+        mpz_clear(previous_pi);
+    }
+
+    mpz_sub_ui(delta, delta, 1);
+    if (mpz_sgn(delta) > 0) {
+        treeint spacer;
+        treeint_view_mpz(&spacer, delta);
+        factor_group->spacer = schedule_factorization(w, &spacer);
+    }
+
+    mpz_clear(delta);
+}
+
+void schedule_power (worker* w, factor* factor_group, int power) {
+    // If the last power group occured more than once, schedule a sub-factorization
+    if (factor_group != NULL) {
+        if (w->ctx->debug) {
+            char* base = treeint_get_str(&factor_group->base);
+            debug_log(w->ctx, "Found factors group: %s ^ %d\n", base, power);
+            free(base);
+        }
+
+        treeint p;
+        treeint_set_ui(&p, power);
+        factor_group->power = schedule_factorization(w, &p);
+    }
+}
+
@@ -0,0 +1,550 @@
+#ifndef SOLSYS_H
+#define SOLSYS_H
+
+#include <msieve.h>
+#include <primecount.h>
+#include <li.h>
+#include "store.h"
+#include "checkpoint.h"
+#include "factor64.h"
+#include "sieve.h"
+#include "arena.h"
+#include "treeint.h"
+
+#include <gmp.h>
+
+#include <pthread.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct composite {
+    treeint value;
+    struct factor* factors;
+
+    // Set when a request's deadline passed before the composite was factored;
+    // the next request to reach it factors it after all
+    int pending;
+} composite;
+
+typedef struct factor {
+    // Next and previous factor in linked list
+    struct factor* next;
+    struct factor* prev;
+
+    // Values of factor itself
+    treeint base;
+	enum msieve_factor_type factor_type;
+    struct composite* power;
+    treeint pi;
+
+    // Difference between this factor and preceding factor
+    struct composite* spacer;
+} factor;
+
+// Orders in which queued composites are expanded: in the order they were
+// scheduled, cheapest first, or a level of the tree at a time
+enum schedule_policy { schedule_fifo, schedule_smallest, schedule_breadth };
+
+// Item of the worklist, with what the policies order it by
+typedef struct worklist {
+    composite* output;
+    char* todo;
+    unsigned long cost;
+    int depth;
+    unsigned long sequence;
+} worklist;
+
+struct solsys_ctx;
+
+// Worklist shared between workers, kept as a binary heap under its policy
+// in_flight counts items that are queued or still being expanded, so an empty
+// queue with in_flight > 0 means more work may still arrive
+// Once expired is set, items still queued are left pending instead of expanded;
+// failed also sets it, when a factorization could not be finished at all
+typedef struct workqueue {
+    struct solsys_ctx* ctx;
+    enum schedule_policy policy;
+    worklist** heap;
+    size_t count;
+    size_t capacity;
+    unsigned long scheduled;
+    int in_flight;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    volatile int expired;
+    volatile int failed;
+
+    // Monotonic time at which the request expires, 0 for never
+    double deadline;
+} workqueue;
+
+// Time spent outside the pi tiers and factor stages: scheduling the children
+// of expanded nodes, and writing trees out; see solsys_stats
+enum solsys_timer { timer_schedule, timer_json, SOLSYS_TIMERS };
+
+typedef struct timer_stats {
+    unsigned long calls;
+    double seconds;
+} timer_stats;
+
+// What answered a node's factorization, from cheapest to dearest; a value
+// the pipeline splits counts under the dearest stage it needed
+enum node_source {
+    node_source_factor64, node_source_range, node_source_store, node_source_checkpoint,
+    node_source_trial, node_source_prime, node_source_power, node_source_pm1, node_source_msieve,
+    NODE_SOURCES
+};
+
+// A worker owns its own msieve seeds and savefile, so concurrent
+// factorizations never share state
+typedef struct worker {
+    int id;
+    int slot;
+    struct solsys_ctx* ctx;
+    workqueue* queue;
+    uint32 seed1;
+    uint32 seed2;
+
+    // Depth below its root of what the worker schedules next
+    int depth;
+
+    // Set when the node being expanded needed an msieve run that could not
+    // finish before the deadline, so it is left pending
+    int deferred;
+
+    // What answered the node being expanded, and the worker's counters and
+    // trace events, merged into the context when the request ends
+    enum node_source source;
+    unsigned long expanded;
+    double expand_seconds;
+    unsigned long node_sources[NODE_SOURCES];
+    timer_stats schedule;
+    char* trace;
+    size_t trace_length;
+    size_t trace_capacity;
+
+    // Nodes this worker creates, handed to the context when the request ends,
+    // and worklist items and temporaries, released when it ends
+    arena nodes;
+    arena scratch;
+    char savefile_name[256];
+    char memory_savefile_name[32];
+    int memory_fd;
+    msieve_obj* volatile curr;
+
+    // Input of the msieve run in progress, whose savefile checkpoints copy
+    char* volatile running;
+} worker;
+
+// Expires a request's queue at its deadline and stops the msieve runs of its
+// workers, and saves the context's checkpoint every interval, until the
+// request finishes. A deadline or interval of 0 is never reached.
+typedef struct watchdog {
+    workqueue* queue;
+    worker* workers;
+    int count;
+    double deadline;
+    double interval;
+    double next_save;
+    int done;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+} watchdog;
+
+// What every msieve run of the process shares; see get_msieve_environment
+typedef struct msieve_environment {
+    enum cpu_type cpu;
+    uint32 cache_size1;
+    uint32 cache_size2;
+    uint64_t seed;
+} msieve_environment;
+
+// Value-keyed cache of composites, so each distinct value is only scheduled
+// and expanded once per context
+typedef struct cache_entry {
+    unsigned long hash;
+    composite* node;
+    struct cache_entry* next;
+} cache_entry;
+
+typedef struct composite_cache {
+    cache_entry** buckets;
+    unsigned long bucket_count;
+    unsigned long size;
+    unsigned long hits;
+    unsigned long misses;
+    pthread_mutex_t lock;
+} composite_cache;
+
+// Buffered JSON output of a tree; see to_json
+#define JSON_BUFFER_SIZE 16384
+#define JSON_INLINE_FRAMES 64
+#define JSON_COMPOSITE 0
+#define JSON_FACTOR 1
+#define JSON_SHAPE 2
+
+typedef struct json_frame {
+    int kind;
+    void* node;
+    factor* next;
+    int stage;
+    int depth;
+
+    // Shape output only: the node's type and how many children it has written
+    int type;
+    int children;
+} json_frame;
+
+typedef struct json_writer {
+    FILE* out;
+    int compact;
+    char buf[JSON_BUFFER_SIZE];
+    size_t length;
+
+    // Deep trees spill the stack from inline_frames onto the heap
+    json_frame inline_frames[JSON_INLINE_FRAMES];
+    json_frame* frames;
+    int frame_capacity;
+} json_writer;
+
+// Ids given to the distinct composites of a tree for DAG output
+typedef struct dag_ids {
+    composite** slots;
+    size_t* slot_ids;
+    size_t capacity;
+
+    // nodes[id] is the composite numbered id
+    composite** nodes;
+    size_t count;
+} dag_ids;
+
+// Ways pi(x) can be answered, each timed separately so the thresholds between
+// them can be picked from data
+enum pi_tier { pi_tier_table, pi_tier_range, pi_tier_sieve, pi_tier_primecount, pi_tier_logint_fast, pi_tier_logint, PI_TIERS };
+
+typedef struct pi_tier_stats {
+    unsigned long calls;
+    double seconds;
+} pi_tier_stats;
+
+// Stages a value too large for factor64 passes through before msieve, each
+// counting the values it was handed, those it settled and the time it took.
+// Trial division settles a value by finding any small factor, the prime test
+// by proving it prime, and the power, p - 1 and msieve stages by splitting it.
+enum factor_stage { factor_stage_trial, factor_stage_prime, factor_stage_power, factor_stage_pm1, factor_stage_msieve, FACTOR_STAGES };
+
+#define TRIAL_DIVISION_LIMIT (1 << 14)
+#define PM1_BOUND 10000
+
+typedef struct factor_stage_stats {
+    unsigned long calls;
+    unsigned long settled;
+    double seconds;
+} factor_stage_stats;
+
+extern const char* pi_tier_names[PI_TIERS];
+extern const char* factor_stage_names[FACTOR_STAGES];
+extern const char* timer_names[SOLSYS_TIMERS];
+extern const char* node_source_names[NODE_SOURCES];
+
+// A context's counters at one moment; the difference between two snapshots
+// is what the context did in between, across all of its requests
+typedef struct solsys_stats {
+    double time;
+    unsigned long cache_hits;
+    unsigned long cache_misses;
+    unsigned long expanded;
+    double expand_seconds;
+    unsigned long node_sources[NODE_SOURCES];
+    pi_tier_stats pi_tiers[PI_TIERS];
+    factor_stage_stats factor_stages[FACTOR_STAGES];
+    timer_stats timers[SOLSYS_TIMERS];
+} solsys_stats;
+
+// Settings for a context; strings are only read during solsys_create
+typedef struct solsys_options {
+    int debug;
+    int compact;
+    int threads;
+    const char* factorization_threshold;
+    const char* logint_threshold;
+    const char* cache_file;
+
+    // Between logint_threshold and exact_limit pi(x) is still counted exactly
+    // when primecount is expected to finish within exact_budget_ms; a NULL
+    // limit ends exact counting at logint_threshold. primecount_threads sizes
+    // primecount's own pool, left at primecount's default when 0.
+    const char* exact_limit;
+    long exact_budget_ms;
+    int primecount_threads;
+
+    // Each request stops factoring after deadline_ms, 0 for no limit, and
+    // returns its tree with the composites it did not reach marked pending.
+    // An msieve run expected to outlast the time left is never started, but
+    // one already running only notices the deadline between sieving batches
+    // (some 10 s apart at 100 digits) and not at all in its linear algebra,
+    // so a request can still overrun by that much.
+    long deadline_ms;
+
+    // Order in which a request expands its composites. Cheapest first, the
+    // default, finishes the most nodes before a deadline; a huge spacer waits
+    // until the small composites around it are done.
+    enum schedule_policy schedule;
+
+    // The state of each request is saved to checkpoint_path every
+    // checkpoint_interval_ms and when it ends, and a context created with a
+    // resume_path starts from the checkpoint there, saving back to it unless
+    // given a checkpoint_path of its own
+    const char* checkpoint_path;
+    const char* resume_path;
+    long checkpoint_interval_ms;
+
+    // msieve's savefiles go in savefile_dir, $TMPDIR or /tmp by default, named
+    // for the process and request so that no two runs share one. Inputs of up
+    // to memory_savefile_digits digits keep them in memory instead; 0 keeps
+    // every savefile on disk.
+    const char* savefile_dir;
+    int memory_savefile_digits;
+
+    // With stats set, callers report a solsys_stats block per request; with
+    // trace_path set, request n writes a Chrome trace of its nodes to
+    // <trace_path>.<n>.json
+    int stats;
+    const char* trace_path;
+
+    // Small pi values are answered from a table, loaded or built on first use
+    int pi_table_enabled;
+    const char* pi_table_path;
+    uint64_t pi_table_bound;
+} solsys_options;
+
+// Everything one embedding of solsys needs. Contexts are independent of each
+// other. One context may be called from several threads, but it builds one
+// request's trees at a time: a request reuses the composites of earlier ones
+// through the cache, and would otherwise find some still being expanded.
+// A tree with pending nodes is only stable until the next request, which may
+// finish them.
+typedef struct solsys_ctx {
+    int debug;
+    int compact;
+    int threads;
+    long deadline_ms;
+    enum schedule_policy schedule;
+    mpz_t factorization_threshold;
+    mpz_t logint_threshold;
+    mpz_t exact_limit;
+    double exact_budget;
+
+    composite_cache cache;
+    pthread_mutex_t request_lock;
+    store* cache_file;
+    checkpoint* checkpoint;
+    long checkpoint_interval_ms;
+    char* savefile_dir;
+    int memory_savefile_digits;
+
+    // Every composite, factor and cache entry the context has created; they
+    // stay shared through the cache until solsys_destroy releases them at once
+    arena nodes;
+    pthread_mutex_t nodes_lock;
+
+    int pi_table_enabled;
+    char* pi_table_path;
+    uint64_t pi_table_bound;
+    pi_table* pi_table;
+    int pi_table_ready;
+    pthread_mutex_t pi_table_lock;
+
+    // Each concurrent li evaluation gets its own working state from the engine
+    logint_engine* logint;
+
+    // Time spent in each pi tier, and the latest primecount run long enough
+    // to predict the cost of the next one from
+    pi_tier_stats pi_tiers[PI_TIERS];
+    double primecount_x;
+    double primecount_seconds;
+    pthread_mutex_t pi_stats_lock;
+
+    factor_stage_stats factor_stages[FACTOR_STAGES];
+    pthread_mutex_t factor_stats_lock;
+
+    // Totals merged from each request's workers when it ends
+    int stats;
+    char* trace_path;
+    double created;
+    unsigned long requests;
+    unsigned long expanded;
+    double expand_seconds;
+    unsigned long node_sources[NODE_SOURCES];
+    timer_stats timers[SOLSYS_TIMERS];
+    pthread_mutex_t stats_lock;
+
+    // The segment of a running solsys_factor_range, which answers the
+    // factorizations and pi values of its numbers for every request meanwhile
+    factor_segment* range;
+    uint64_t range_pi_before;
+    int range_pi_known;
+    pthread_rwlock_t range_lock;
+} solsys_ctx;
+
+// Receives each tree of solsys_factor_range
+typedef void (*solsys_range_callback)(solsys_ctx*, composite* tree, void* arg);
+
+// Workers of every context that are currently factoring, so
+// solsys_stop_sieving can stop every running msieve
+#define SOLSYS_MAX_WORKERS 256
+
+/*--------------------------------------------------------------------*/
+// PUBLIC API
+
+// The first context installs solsys's GMP allocator, so it must be created
+// before anything else in the process uses GMP. Trees are shared through the
+// context's cache and are only released, all together, when the context is
+// destroyed, so a long-lived context grows with every distinct value it sees.
+void solsys_default_options(solsys_options*);
+solsys_ctx* solsys_create(const solsys_options*);
+composite* solsys_factor_tree(solsys_ctx*, const char* number);
+int solsys_factor_batch(solsys_ctx*, const char** numbers, int count, composite** trees);
+char* solsys_to_buffer(solsys_ctx*, composite*, size_t* length);
+void solsys_factor_range(solsys_ctx*, uint64_t a, uint64_t b, solsys_range_callback, void* arg);
+char** solsys_checkpoint_roots(solsys_ctx*, int* count);
+int solsys_stop_sieving();
+void solsys_stats_snapshot(solsys_ctx*, solsys_stats*);
+void solsys_stats_write(solsys_ctx*, solsys_stats* since, FILE*);
+double solsys_timer_record(solsys_ctx*, enum solsys_timer, unsigned long calls, double start);
+void solsys_destroy(solsys_ctx*);
+
+/*--------------------------------------------------------------------*/
+// INTERNALS
+
+void debug_log(solsys_ctx*, char* format, ...);
+
+void to_json(FILE*, composite*, int compact);
+void json_writer_init(json_writer*, FILE* out, int compact);
+void json_writer_free(json_writer*);
+void json_flush(json_writer*);
+void json_put(json_writer*, const char* s, size_t length);
+void json_put_treeint(json_writer*, treeint* value);
+void json_put_pending(json_writer*, composite*, int depth);
+void json_newline(json_writer*, int depth);
+void json_key(json_writer*, const char* name);
+void json_push(json_writer*, int* count, int kind, void* node, int depth);
+void json_write_tree(json_writer*, composite* tree);
+void to_shape(FILE*, composite*, int compact);
+void to_shape_key(FILE*, composite*);
+void json_write_shape(json_writer*, composite* tree, int canonical);
+void to_dag(FILE*, composite*, int compact);
+void json_put_dag_id(json_writer*, dag_ids*, composite*);
+void init_dag_ids(dag_ids*);
+void free_dag_ids(dag_ids*);
+size_t dag_slot(dag_ids*, composite*);
+size_t dag_id(dag_ids*, composite*);
+void grow_dag_ids(dag_ids*);
+
+void init_composite_cache(composite_cache*);
+void free_composite_cache(composite_cache*);
+composite* cache_composite(composite_cache*, treeint* value, int* created, arena* nodes);
+
+void init_workqueue(workqueue*, solsys_ctx*);
+void free_workqueue(workqueue*);
+worklist* take_work(workqueue*);
+void finish_work(workqueue*);
+void fail_work(workqueue*);
+int work_before(workqueue*, worklist* a, worklist* b);
+void push_work(workqueue*, worklist*);
+unsigned long estimate_cost(treeint* number);
+composite* schedule_factorization (worker*, treeint* number);
+
+void init_worker(worker*, int id, solsys_ctx*, workqueue*);
+void free_worker(worker*);
+void register_workers(worker*, int count);
+void unregister_workers(worker*, int count);
+void* run_worker(void* w);
+void merge_worker_stats(worker*);
+void node_answered(worker*, enum node_source);
+void trace_node(worker*, worklist* item, double start, double pi_seconds);
+void write_trace(solsys_ctx*, worker* workers, int count, unsigned long request);
+void open_savefiles(worker*);
+void close_savefiles(worker*);
+char* worker_savefile(worker*, char* input);
+
+void start_watchdog(watchdog*, workqueue*, worker* workers, int count);
+void stop_watchdog(watchdog*);
+void* run_watchdog(void* dog);
+void save_checkpoint(watchdog*);
+int solsys_checkpointing(solsys_ctx*);
+
+int __wrap_mpz_aprcl(mpz_t n);
+void init_msieve_environment();
+msieve_environment* get_msieve_environment();
+void get_random_seeds(uint32* seed1, uint32* seed2);
+msieve_obj * make_default_msieve_obj(char* savefile_name);
+msieve_obj * run_default_msieve(worker*, char* input);
+double msieve_predict(int digits);
+
+char* encode_msieve_factors(msieve_factor*);
+msieve_factor* decode_msieve_factors(char*);
+void free_msieve_factors(msieve_factor*);
+int parse_u64(char* input, uint64_t* out);
+msieve_factor* factor_list_u64(uint64_t* primes, int count);
+msieve_factor* factor_small(uint64_t n);
+msieve_factor* factor_from_range(solsys_ctx*, uint64_t n);
+msieve_factor* collect_factors(worker*, char* input);
+
+msieve_factor* factor_pipeline(worker*, char* input);
+void trial_divide(solsys_ctx*, mpz_t n, msieve_factor** found);
+int split_cofactor(worker*, mpz_t n, msieve_factor** found);
+unsigned long perfect_power(mpz_t n, mpz_t root);
+int pm1_split(mpz_t n, mpz_t g);
+int msieve_cofactor(worker*, mpz_t n, msieve_factor** found);
+void add_factor_str(msieve_factor** found, const char* number, enum msieve_factor_type);
+void add_factor(msieve_factor** found, mpz_t p, enum msieve_factor_type);
+void add_factor_ui(msieve_factor** found, uint64_t p);
+int compare_msieve_factors(const void* a, const void* b);
+msieve_factor* sort_msieve_factors(msieve_factor*);
+void factor_stage_record(solsys_ctx*, enum factor_stage, int settled, double start);
+
+int msieve_factor_eq_factor_group (factor* factor_group, treeint* parsed);
+void schedule_power (worker*, factor* factor_group, int power);
+void schedule_spacer (worker*, factor* factor_group);
+factor* initialize_factor_group (arena* nodes, composite* parent, factor* previous_group, msieve_factor* source, treeint* parsed);
+void expand_composite (worker*, worklist* curr);
+composite* factor_composite (solsys_ctx*, const char* number);
+int factor_composites (solsys_ctx*, const char** numbers, int count, composite** trees);
+
+pi_table* get_pi_table (solsys_ctx*);
+int pix_from_range (solsys_ctx*, uint64_t x, treeint* result);
+int pix_from_table (solsys_ctx*, treeint* x, treeint* result);
+int pix_lookup (solsys_ctx*, treeint* x, treeint* result, int exact, arena*);
+void pix_record (solsys_ctx*, treeint* x, treeint* result, int exact);
+double solsys_now ();
+double pi_tier_record (solsys_ctx*, enum pi_tier, unsigned long calls, double start);
+double primecount_predict (solsys_ctx*, treeint* x);
+int pix_is_exact (solsys_ctx*, treeint* x);
+int pix_using_threshold (solsys_ctx*, treeint* x, treeint* result, arena*);
+void pix_approximate (solsys_ctx*, treeint** xs, treeint** results, int count, arena*);
+void pix_batch (solsys_ctx*, treeint** xs, treeint** results, int count, arena*);
+int primecount_treeint (treeint* x, treeint* result, arena*);
+void logint_treeint (solsys_ctx*, treeint* x, treeint* result, arena*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,238 @@
+#include "store.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*--------------------------------------------------------------------*/
+// OPENING AND CLOSING
+
+store* store_open (const char* path) {
+    int writable = 1;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        writable = 0;
+        fd = open(path, O_RDONLY);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "could not open cache file %s\n", path);
+        return NULL;
+    }
+
+    // Initialize an empty file under the writer lock, so two processes
+    // creating the store at once cannot both write a header
+    if (writable) {
+        flock(fd, LOCK_EX);
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size == 0) {
+            char header[STORE_HEADER_SIZE] = {0};
+            store_header* h = (store_header*) header;
+            memcpy(h->magic, STORE_MAGIC, 8);
+            h->committed = STORE_HEADER_SIZE;
+            if (pwrite(fd, header, STORE_HEADER_SIZE, 0) != STORE_HEADER_SIZE) writable = 0;
+        }
+        flock(fd, LOCK_UN);
+    }
+
+    int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    char* map = mmap(NULL, STORE_MAX_SIZE, prot, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "could not map cache file %s\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    // Records are only read below committed, so it must lie within the file
+    struct stat st;
+    store_header* h = (store_header*) map;
+    if (fstat(fd, &st) != 0 || st.st_size < STORE_HEADER_SIZE || memcmp(map, STORE_MAGIC, 8) != 0
+        || h->committed < STORE_HEADER_SIZE || h->committed > (uint64_t) st.st_size || h->committed > STORE_MAX_SIZE) {
+        fprintf(stderr, "%s is not a solsys cache file\n", path);
+        munmap(map, STORE_MAX_SIZE);
+        close(fd);
+        return NULL;
+    }
+
+    store* s = malloc(sizeof(store));
+    s->fd = fd;
+    s->writable = writable;
+    s->map = map;
+    s->bucket_count = 1024;
+    s->buckets = calloc(s->bucket_count, sizeof(store_entry*));
+    s->size = 0;
+    s->indexed = STORE_HEADER_SIZE;
+    s->damaged = 0;
+    pthread_mutex_init(&s->lock, NULL);
+    return s;
+}
+
+void store_close (store* s) {
+    if (s == NULL) return;
+    for (unsigned long ii = 0; ii < s->bucket_count; ii++) {
+        store_entry* entry = s->buckets[ii];
+        while (entry != NULL) {
+            store_entry* next = entry->next;
+            free(entry);
+            entry = next;
+        }
+    }
+    free(s->buckets);
+    munmap(s->map, STORE_MAX_SIZE);
+    close(s->fd);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+}
+
+/*--------------------------------------------------------------------*/
+// INDEX
+
+uint64_t store_committed (store* s) {
+    store_header* h = (store_header*) s->map;
+    return __atomic_load_n(&h->committed, __ATOMIC_ACQUIRE);
+}
+
+uint64_t store_record_size (uint32_t key_length, uint32_t value_length) {
+    uint64_t size = sizeof(store_record) + key_length + 1 + value_length + 1;
+    return (size + 7) & ~(uint64_t) 7;
+}
+
+unsigned long store_hash (enum store_kind kind, const char* key) {
+    unsigned long hash = 14695981039346656037UL ^ kind;
+    for (const char* c = key; *c != '\0'; c++) {
+        hash ^= (unsigned char) *c;
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+void store_grow_index (store* s) {
+    unsigned long bucket_count = s->bucket_count * 2;
+    store_entry** buckets = calloc(bucket_count, sizeof(store_entry*));
+
+    for (unsigned long ii = 0; ii < s->bucket_count; ii++) {
+        store_entry* entry = s->buckets[ii];
+        while (entry != NULL) {
+            store_entry* next = entry->next;
+            entry->next = buckets[entry->hash % bucket_count];
+            buckets[entry->hash % bucket_count] = entry;
+            entry = next;
+        }
+    }
+
+    free(s->buckets);
+    s->buckets = buckets;
+    s->bucket_count = bucket_count;
+}
+
+// Index every record appended (by any process) since the last refresh. A
+// record whose header or payload would reach past committed or the end of
+// the file, or whose strings are not terminated, ends the index for good.
+// Must hold s->lock
+void store_refresh (store* s) {
+    if (s->damaged) return;
+
+    uint64_t limit = store_committed(s);
+    struct stat st;
+    if (fstat(s->fd, &st) != 0) return;
+    if (limit > (uint64_t) st.st_size) limit = st.st_size;
+    if (limit > STORE_MAX_SIZE) limit = STORE_MAX_SIZE;
+
+    while (s->indexed < limit) {
+        store_record* rec = (store_record*) (s->map + s->indexed);
+        const char* key = (const char*) (rec + 1);
+        if (limit - s->indexed < sizeof(store_record)
+            || limit - s->indexed < store_record_size(rec->key_length, rec->value_length)
+            || key[rec->key_length] != '\0' || key[rec->key_length + 1 + rec->value_length] != '\0') {
+            fprintf(stderr, "cache file is damaged after offset %llu; later records are ignored\n",
+                    (unsigned long long) s->indexed);
+            s->damaged = 1;
+            return;
+        }
+
+        store_entry* entry = malloc(sizeof(store_entry));
+        entry->hash = store_hash(rec->kind, key);
+        entry->offset = s->indexed;
+        entry->next = s->buckets[entry->hash % s->bucket_count];
+        s->buckets[entry->hash % s->bucket_count] = entry;
+        s->size++;
+        if (s->size > s->bucket_count) store_grow_index(s);
+
+        s->indexed += store_record_size(rec->key_length, rec->value_length);
+    }
+}
+
+store_record* store_find (store* s, enum store_kind kind, const char* key) {
+    unsigned long hash = store_hash(kind, key);
+    store_entry* entry = s->buckets[hash % s->bucket_count];
+    while (entry != NULL) {
+        store_record* rec = (store_record*) (s->map + entry->offset);
+        if (entry->hash == hash && rec->kind == kind && strcmp((const char*) (rec + 1), key) == 0) {
+            return rec;
+        }
+        entry = entry->next;
+    }
+    return NULL;
+}
+
+/*--------------------------------------------------------------------*/
+// LOOKUP AND APPEND
+
+// Returns a malloc'd copy of the value for key, or NULL if not stored
+char* store_get (store* s, enum store_kind kind, const char* key) {
+    if (s == NULL) return NULL;
+
+    pthread_mutex_lock(&s->lock);
+    store_record* rec = store_find(s, kind, key);
+    if (rec == NULL && !s->damaged && s->indexed < store_committed(s)) {
+        store_refresh(s);
+        rec = store_find(s, kind, key);
+    }
+
+    char* value = NULL;
+    if (rec != NULL) {
+        value = strdup((const char*) (rec + 1) + rec->key_length + 1);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return value;
+}
+
+// Appends a record; readers only see it once the header's committed offset
+// moves past it, so a crash mid-write leaves the store consistent
+void store_put (store* s, enum store_kind kind, const char* key, const char* value) {
+    if (s == NULL || !s->writable) return;
+
+    uint32_t key_length = strlen(key);
+    uint32_t value_length = strlen(value);
+    uint64_t size = store_record_size(key_length, value_length);
+
+    char* buf = calloc(1, size);
+    store_record* rec = (store_record*) buf;
+    rec->key_length = key_length;
+    rec->value_length = value_length;
+    rec->kind = kind;
+    memcpy(buf + sizeof(store_record), key, key_length + 1);
+    memcpy(buf + sizeof(store_record) + key_length + 1, value, value_length + 1);
+
+    pthread_mutex_lock(&s->lock);
+    flock(s->fd, LOCK_EX);
+
+    // Another process may have stored the same key while we were computing it
+    store_refresh(s);
+    uint64_t committed = store_committed(s);
+    if (store_find(s, kind, key) == NULL && committed + size <= STORE_MAX_SIZE) {
+        if (pwrite(s->fd, buf, size, committed) == (ssize_t) size) {
+            store_header* h = (store_header*) s->map;
+            __atomic_store_n(&h->committed, committed + size, __ATOMIC_RELEASE);
+        }
+    }
+
+    flock(s->fd, LOCK_UN);
+    pthread_mutex_unlock(&s->lock);
+    free(buf);
+}
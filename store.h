@@ -0,0 +1,57 @@
+#include <stdint.h>
+#include <pthread.h>
+
+// Append-only, memory-mapped key/value file shared between solsys processes.
+// Many processes may read while one at a time appends (serialized by flock).
+
+// Records are keyed by kind as well as by the decimal key, so the same number
+// can have a factorization, an exact pi and an approximate pi at once
+enum store_kind {
+    STORE_FACTORS = 1,
+    STORE_PI = 2,
+    // 3 held li values evaluated at 53 bits, which are not reused
+    STORE_LI = 4
+};
+
+#define STORE_MAGIC "SOLSYSC1"
+#define STORE_HEADER_SIZE 64
+// Address space reserved for the mapping; the file itself grows on demand
+#define STORE_MAX_SIZE ((uint64_t) 1 << 34)
+
+typedef struct store_header {
+    char magic[8];
+    uint64_t committed; // end of the last fully written record
+} store_header;
+
+typedef struct store_record {
+    uint32_t key_length;
+    uint32_t value_length;
+    uint8_t kind;
+    uint8_t pad[3];
+    // followed by key and value, each NUL terminated, padded to 8 bytes
+} store_record;
+
+typedef struct store_entry {
+    unsigned long hash;
+    uint64_t offset;
+    struct store_entry* next;
+} store_entry;
+
+typedef struct store {
+    int fd;
+    int writable;
+    char* map;
+
+    // In-process index over records up to indexed
+    store_entry** buckets;
+    unsigned long bucket_count;
+    unsigned long size;
+    uint64_t indexed;
+    int damaged; // set at the first record that does not fit, which ends the index
+    pthread_mutex_t lock;
+} store;
+
+store* store_open(const char* path);
+void store_close(store*);
+char* store_get(store*, enum store_kind, const char* key);
+void store_put(store*, enum store_kind, const char* key, const char* value);
@@ -0,0 +1,156 @@
+#include "treeint.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*--------------------------------------------------------------------*/
+// SETTING AND READING
+
+void treeint_set_ui (treeint* t, uint64_t value) {
+    t->word = value;
+    t->big = NULL;
+}
+
+// Copies value, promoting it into a new mpz in a if it does not fit a word
+void treeint_set_mpz (treeint* t, mpz_t value, arena* a) {
+    if (mpz_sizeinbase(value, 2) <= 64) {
+        treeint_set_ui(t, mpz_get_ui(value));
+        return;
+    }
+
+    t->word = 0;
+    t->big = arena_alloc(a, sizeof(__mpz_struct));
+    arena* previous = arena_use(a);
+    mpz_init_set(t->big, value);
+    arena_use(previous);
+}
+
+// Parses a decimal string, returning 0 if it is not one
+int treeint_set_str (treeint* t, const char* decimal, arena* a) {
+    size_t length = strlen(decimal);
+    if (length == 0) return 0;
+
+    // Up to 19 digits always fits, so skip GMP entirely
+    if (length < TREEINT_WORD_DIGITS - 1) {
+        uint64_t value = 0;
+        for (size_t ii = 0; ii < length; ii++) {
+            if (decimal[ii] < '0' || decimal[ii] > '9') return 0;
+            value = value * 10 + (decimal[ii] - '0');
+        }
+        treeint_set_ui(t, value);
+        return 1;
+    }
+
+    mpz_t value;
+    mpz_init(value);
+    int ok = mpz_set_str(value, decimal, 10) == 0;
+    if (ok) treeint_set_mpz(t, value, a);
+    mpz_clear(value);
+    return ok;
+}
+
+// Makes t stand for value without copying it, so value must outlive t
+void treeint_view_mpz (treeint* t, mpz_t value) {
+    if (mpz_sizeinbase(value, 2) <= 64) {
+        treeint_set_ui(t, mpz_get_ui(value));
+    } else {
+        t->word = 0;
+        t->big = value;
+    }
+}
+
+void treeint_copy (treeint* dst, treeint* src, arena* a) {
+    if (src->big == NULL) {
+        treeint_set_ui(dst, src->word);
+    } else {
+        treeint_set_mpz(dst, src->big, a);
+    }
+}
+
+// out must already be initialized
+void treeint_get_mpz (mpz_t out, treeint* t) {
+    if (t->big == NULL) {
+        mpz_set_ui(out, t->word);
+    } else {
+        mpz_set(out, t->big);
+    }
+}
+
+/*--------------------------------------------------------------------*/
+// COMPARING AND HASHING
+
+// Promoted values are always larger than inline ones
+int treeint_cmp (treeint* a, treeint* b) {
+    if (a->big == NULL && b->big == NULL) {
+        return (a->word > b->word) - (a->word < b->word);
+    }
+    if (a->big == NULL) return -1;
+    if (b->big == NULL) return 1;
+    return mpz_cmp(a->big, b->big);
+}
+
+int treeint_cmp_mpz (treeint* t, mpz_t value) {
+    if (t->big != NULL) return mpz_cmp(t->big, value);
+    if (mpz_sizeinbase(value, 2) > 64) return -mpz_sgn(value);
+    uint64_t word = mpz_get_ui(value);
+    return (t->word > word) - (t->word < word);
+}
+
+// Bits in the value, 0 for 0
+size_t treeint_bits (treeint* t) {
+    if (t->big != NULL) return mpz_sizeinbase(t->big, 2);
+    return t->word == 0 ? 0 : 64 - __builtin_clzll(t->word);
+}
+
+// FNV-1a over the 64-bit words of the value
+unsigned long hash_treeint (treeint* t) {
+    unsigned long hash = 14695981039346656037UL;
+    if (t->big == NULL) {
+        hash ^= t->word;
+        hash *= 1099511628211UL;
+        return hash;
+    }
+
+    size_t limbs = mpz_size(t->big);
+    for (size_t ii = 0; ii < limbs; ii++) {
+        hash ^= (unsigned long) mpz_getlimbn(t->big, ii);
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+/*--------------------------------------------------------------------*/
+// DECIMAL OUTPUT
+
+// Room treeint_to_str needs, including the NUL
+size_t treeint_max_digits (treeint* t) {
+    if (t->big == NULL) return TREEINT_WORD_DIGITS;
+    return mpz_sizeinbase(t->big, 10) + 2;
+}
+
+// Writes t in decimal, NUL terminated, returning the number of digits
+size_t treeint_to_str (char* out, treeint* t) {
+    if (t->big != NULL) {
+        mpz_get_str(out, 10, t->big);
+        return strlen(out);
+    }
+
+    char digits[TREEINT_WORD_DIGITS];
+    size_t length = 0;
+    uint64_t word = t->word;
+    do {
+        digits[length++] = '0' + word % 10;
+        word /= 10;
+    } while (word != 0);
+
+    for (size_t ii = 0; ii < length; ii++) out[ii] = digits[length - 1 - ii];
+    out[length] = '\0';
+    return length;
+}
+
+// Decimal string of t, malloc'd
+char* treeint_get_str (treeint* t) {
+    char* out = malloc(treeint_max_digits(t));
+    treeint_to_str(out, t);
+    return out;
+}
@@ -0,0 +1,38 @@
+#ifndef SOLSYS_TREEINT_H
+#define SOLSYS_TREEINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <gmp.h>
+#include "arena.h"
+
+// Non-negative integer for tree values. Almost every value below the root
+// fits in a machine word, so it is stored inline and only promoted to an mpz,
+// allocated from an arena, when it does not. A value is promoted exactly when
+// it exceeds UINT64_MAX, so equal values always have the same form.
+
+// Digits in UINT64_MAX, plus the NUL
+#define TREEINT_WORD_DIGITS 21
+
+typedef struct treeint {
+    uint64_t word;
+    mpz_ptr big; // NULL while the value is word
+} treeint;
+
+void treeint_set_ui(treeint*, uint64_t value);
+void treeint_set_mpz(treeint*, mpz_t value, arena*);
+int treeint_set_str(treeint*, const char* decimal, arena*);
+void treeint_view_mpz(treeint*, mpz_t value);
+void treeint_copy(treeint* dst, treeint* src, arena*);
+void treeint_get_mpz(mpz_t out, treeint*);
+
+int treeint_cmp(treeint*, treeint*);
+int treeint_cmp_mpz(treeint*, mpz_t);
+size_t treeint_bits(treeint*);
+unsigned long hash_treeint(treeint*);
+
+size_t treeint_max_digits(treeint*);
+size_t treeint_to_str(char* out, treeint*);
+char* treeint_get_str(treeint*);
+
+#endif